@@ -3,10 +3,25 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cmath>
+#include <chrono>
 #include <direct.h> 
 #include <windows.h> 
 #include "simple_vector.h"
 #include "simple_hash.h"
+#include "lexicon.h"
+#include "segments.h"
+#include "buffered_writer.h"
+#include "doc_reorder.h"
+#include "near_dup.h"
+#include "forward_index.h"
+#include "roaring.h"
+#include "ngram_index.h"
+#include "completion.h"
+#include "scores.h"
+#include "build_profile.h"
+#include "postings.h"
+#include "varint.h"
 
 struct DocEntry {
     int doc_id;
@@ -31,26 +46,141 @@ struct TermData {
     TermData() : doc_count(0) {}
 };
 
-struct TermInfo {
-    char term[256];
+struct TermRef {
+    const char* term;
     int term_id;
-    int doc_count;
-    long file_offset;
     
-    TermInfo() : term_id(0), doc_count(0), file_offset(0) {
-        term[0] = '\0';
+    TermRef() : term(nullptr), term_id(0) {}
+    TermRef(const char* t, int id) : term(t), term_id(id) {}
+};
+
+inline int term_byte(const TermRef& ref, size_t depth) {
+    return static_cast<unsigned char>(ref.term[depth]);
+}
+
+inline void swap_refs(TermRef* refs, size_t i, size_t j) {
+    TermRef temp = refs[i];
+    refs[i] = refs[j];
+    refs[j] = temp;
+}
+
+// Многоключевая быстрая сортировка (Bentley-Sedgewick) по байтам UTF-8:
+// разбиение на три части по байту depth, равная часть сортируется дальше
+// по следующему байту, поэтому общие префиксы не сравниваются повторно.
+void sort_terms(TermRef* refs, size_t n, size_t depth) {
+    while (n > 1) {
+        if (n < 16) {
+            for (size_t i = 1; i < n; i++) {
+                TermRef key = refs[i];
+                size_t j = i;
+                while (j > 0 && strcmp(key.term + depth, refs[j - 1].term + depth) < 0) {
+                    refs[j] = refs[j - 1];
+                    j--;
+                }
+                refs[j] = key;
+            }
+            return;
+        }
+        
+        int a = term_byte(refs[0], depth);
+        int b = term_byte(refs[n / 2], depth);
+        int c = term_byte(refs[n - 1], depth);
+        int pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            int ch = term_byte(refs[i], depth);
+            if (ch < pivot) {
+                swap_refs(refs, lt++, i++);
+            } else if (ch > pivot) {
+                swap_refs(refs, i, --gt);
+            } else {
+                i++;
+            }
+        }
+        
+        sort_terms(refs, lt, depth);
+        if (pivot != 0) sort_terms(refs + lt, gt - lt, depth + 1);
+        refs += gt;
+        n -= gt;
     }
+}
+
+enum DedupMode { DEDUP_OFF, DEDUP_TAG, DEDUP_DROP };
+
+struct IndexOptions {
+    bool zipf_stats;
+    bool reorder_docs;
+    DedupMode dedup;
+    bool forward_index;
+    
+    IndexOptions() : zipf_stats(false), reorder_docs(false), dedup(DEDUP_OFF), forward_index(false) {}
+};
+
+struct GapStats {
+    long long postings;
+    long long varint_bytes;
+    long long bench_matches;
+    double intersect_ms;
+    
+    GapStats() : postings(0), varint_bytes(0), bench_matches(0), intersect_ms(0) {}
+};
+
+struct DocKey {
+    int doc_id;
+    int index;
+    
+    DocKey() : doc_id(0), index(0) {}
+    DocKey(int d, int i) : doc_id(d), index(i) {}
     
-    TermInfo(const char* t, int id) : term_id(id), doc_count(0), file_offset(0) {
-        strncpy(term, t, sizeof(term) - 1);
-        term[sizeof(term) - 1] = '\0';
+    bool operator<(const DocKey& other) const {
+        return doc_id < other.doc_id;
     }
+};
+
+struct RankEntry {
+    long long cf;
+    int df;
+    int ref;
+    
+    RankEntry() : cf(0), df(0), ref(0) {}
+    RankEntry(long long c, int d, int r) : cf(c), df(d), ref(r) {}
     
-    bool operator<(const TermInfo& other) const {
-        return strcmp(term, other.term) < 0;
+    bool operator<(const RankEntry& other) const {
+        if (cf != other.cf) return cf > other.cf;
+        return ref < other.ref;
     }
 };
 
+struct ZipfFit {
+    long long total_occurrences;
+    double s;
+    double c;
+    double r_squared;
+    
+    ZipfFit() : total_occurrences(0), s(0), c(0), r_squared(0) {}
+};
+
+void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (const char* p = str; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', file);
+        fputc(*p, file);
+    }
+    fputc('"', file);
+}
+
+void write_json_tokens(FILE* file, const char* key, SimpleVector<RankEntry>& ranks,
+                       SimpleVector<TermRef>& vocab, size_t from, size_t to) {
+    fprintf(file, "  \"%s\": [", key);
+    for (size_t i = from; i < to; i++) {
+        fprintf(file, "%s\n    [", i > from ? "," : "");
+        write_json_string(file, vocab.get(ranks.get(i).ref).term);
+        fprintf(file, ", %lld, %d]", ranks.get(i).cf, ranks.get(i).df);
+    }
+    fprintf(file, "\n  ]");
+}
+
 class BoolIndexer {
 private:
     TermDict term_to_id;
@@ -58,6 +188,31 @@ private:
     SimpleVector<char*> doc_names;
     int next_id;
     int doc_count;
+    IndexOptions options;
+    GapStats reorder_before;
+    GapStats reorder_after;
+    bool reordered;
+    MinHashSketch sketch;
+    int sketch_doc;
+    SimpleVector<uint32_t> signatures;
+    SimpleVector<char> has_signature;
+    SimpleVector<char*> duplicate_report;
+    int duplicates_found;
+    long long removed_postings;
+    long long removed_positions;
+    long long occurrences;
+    
+    void finish_sketch() {
+        if (sketch_doc < 0) return;
+        while (static_cast<int>(has_signature.size()) <= sketch_doc) {
+            has_signature.push(0);
+            for (int i = 0; i < MINHASH_SIZE; i++) signatures.push(0);
+        }
+        has_signature.get(sketch_doc) =
+            sketch.finish(&signatures.get(static_cast<size_t>(sketch_doc) * MINHASH_SIZE)) ? 1 : 0;
+        sketch.reset();
+        sketch_doc = -1;
+    }
     
     void ensure_capacity(int id) {
         while (static_cast<int>(index_data.size()) <= id) {
@@ -65,8 +220,90 @@ private:
         }
     }
     
+    // Частоты в коллекции (cf) и в документах (df), таблица ранг-частота и
+    // подгонка закона Ципфа f = C / r^s методом наименьших квадратов в
+    // логарифмах, как в zipf_analysis.py, но без повторного чтения корпуса.
+    ZipfFit save_zipf(const char* out_dir, SimpleVector<TermRef>& vocab) {
+        ZipfFit fit;
+        SimpleVector<RankEntry> ranks;
+        ranks.reserve(vocab.size());
+        for (size_t i = 0; i < vocab.size(); i++) {
+            TermData* data = index_data.get(vocab.get(i).term_id);
+            if (!data || data->docs.size() == 0) continue;
+            long long cf = 0;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                cf += data->docs.get(j).positions.size();
+            }
+            ranks.push(RankEntry(cf, data->doc_count, static_cast<int>(i)));
+            fit.total_occurrences += cf;
+        }
+        ranks.sort_quick();
+        
+        double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0, sum_yy = 0;
+        size_t n = ranks.size();
+        for (size_t i = 0; i < n; i++) {
+            double x = log(static_cast<double>(i + 1));
+            double y = log(static_cast<double>(ranks.get(i).cf));
+            sum_x += x;
+            sum_y += y;
+            sum_xx += x * x;
+            sum_xy += x * y;
+            sum_yy += y * y;
+        }
+        double sxx = sum_xx - sum_x * sum_x / n;
+        double sxy = sum_xy - sum_x * sum_y / n;
+        double syy = sum_yy - sum_y * sum_y / n;
+        if (n > 1 && sxx > 0) {
+            double slope = sxy / sxx;
+            fit.s = -slope;
+            fit.c = exp((sum_y - slope * sum_x) / n);
+            fit.r_squared = syy > 0 ? sxy * sxy / (sxx * syy) : 1.0;
+        }
+        
+        char path[512];
+        snprintf(path, sizeof(path), "%s/zipf_data.csv", out_dir);
+        BufferedWriter csv;
+        if (csv.open(path)) {
+            const char* header = "rank,token,frequency,document_frequency,log_rank,log_frequency\n";
+            csv.write(header, strlen(header));
+            char line[128];
+            for (size_t i = 0; i < n; i++) {
+                const RankEntry& entry = ranks.get(i);
+                const char* term = vocab.get(entry.ref).term;
+                csv.write_decimal(static_cast<long long>(i + 1));
+                csv.put(',');
+                csv.write(term, strlen(term));
+                int len = snprintf(line, sizeof(line), ",%lld,%d,%.6f,%.6f\n", entry.cf, entry.df,
+                                   log(static_cast<double>(i + 1)), log(static_cast<double>(entry.cf)));
+                csv.write(line, len);
+            }
+            if (!csv.close()) std::cerr << "Ошибка записи zipf_data.csv" << std::endl;
+        }
+        
+        snprintf(path, sizeof(path), "%s/zipf_results.json", out_dir);
+        FILE* json = fopen(path, "w");
+        if (json) {
+            size_t top = n < 50 ? n : 50;
+            fprintf(json, "{\n");
+            fprintf(json, "  \"total_unique_tokens\": %zu,\n", n);
+            fprintf(json, "  \"total_tokens\": %lld,\n", fit.total_occurrences);
+            fprintf(json, "  \"zipf_parameter_s\": %.10f,\n", fit.s);
+            fprintf(json, "  \"zipf_constant_C\": %.6f,\n", fit.c);
+            fprintf(json, "  \"r_squared\": %.6f,\n", fit.r_squared);
+            write_json_tokens(json, "most_common_tokens", ranks, vocab, 0, top);
+            fprintf(json, ",\n");
+            write_json_tokens(json, "least_common_tokens", ranks, vocab, n - top, n);
+            fprintf(json, "\n}\n");
+            fclose(json);
+        }
+        
+        return fit;
+    }
+    
 public:
-    BoolIndexer() : next_id(0), doc_count(0) {}
+    BoolIndexer(const IndexOptions& opts = IndexOptions()) : next_id(0), doc_count(0), options(opts), reordered(false),
+          sketch_doc(-1), duplicates_found(0), removed_postings(0), removed_positions(0),
+          occurrences(0) {}
     
     ~BoolIndexer() {
         for (size_t i = 0; i < doc_names.size(); i++) {
@@ -75,6 +312,9 @@ public:
         for (size_t i = 0; i < index_data.size(); i++) {
             if (index_data.get(i)) delete index_data.get(i);
         }
+        for (size_t i = 0; i < duplicate_report.size(); i++) {
+            free(duplicate_report.get(i));
+        }
     }
     
     int add_doc(const char* name) {
@@ -84,34 +324,110 @@ public:
         return doc_count++;
     }
     
-    void add_occurrence(const char* term, int doc_id, int pos) {
-        int term_id;
-        if (!term_to_id.find(term, term_id)) {
-            term_id = next_id++;
-            term_to_id.add(term, term_id);
-            ensure_capacity(term_id);
-            index_data.get(term_id) = new TermData();
+    int term_id(const char* term, size_t len) {
+        bool added;
+        int id = term_to_id.find_or_add(term, len, next_id, added);
+        if (added) {
+            next_id++;
+            ensure_capacity(id);
+            index_data.get(id) = new TermData();
         }
-        
+        return id;
+    }
+    
+    // Документы обрабатываются по возрастанию номера, поэтому вхождение
+    // либо продолжает последнюю запись термина, либо открывает новую.
+    void add_occurrence(int term_id, int doc_id, int pos) {
         TermData* data = index_data.get(term_id);
         if (!data) return;
         
-        DocEntry* entry = nullptr;
-        for (size_t i = 0; i < data->docs.size(); i++) {
-            if (data->docs.get(i).doc_id == doc_id) {
-                entry = &data->docs.get(i);
-                break;
+        if (options.dedup != DEDUP_OFF) {
+            if (doc_id != sketch_doc) {
+                finish_sketch();
+                sketch_doc = doc_id;
             }
+            sketch.add(static_cast<uint32_t>(term_id));
         }
         
-        if (!entry) {
+        size_t n = data->docs.size();
+        if (n == 0 || data->docs.get(n - 1).doc_id != doc_id) {
             DocEntry new_entry(doc_id);
             data->docs.push(new_entry);
-            entry = &data->docs.get(data->docs.size() - 1);
             data->doc_count++;
+            n++;
+        }
+        
+        data->docs.get(n - 1).positions.push(pos);
+        occurrences++;
+    }
+    
+    void add_occurrence(const char* term, int doc_id, int pos) {
+        add_occurrence(term_id(term, strlen(term)), doc_id, pos);
+    }
+    
+    // Размер списков документов при кодировании d-промежутков varint и время
+    // декодирования с попарным пересечением для самых частых терминов.
+    GapStats gap_stats() {
+        GapStats stats;
+        SimpleVector<RankEntry> frequent;
+        for (size_t t = 0; t < index_data.size(); t++) {
+            TermData* data = index_data.get(t);
+            if (!data || data->docs.size() == 0) continue;
+            int prev = -1;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                int doc = data->docs.get(j).doc_id;
+                stats.varint_bytes += varint_size(doc - prev);
+                prev = doc;
+            }
+            stats.postings += data->docs.size();
+            frequent.push(RankEntry(data->doc_count, data->doc_count, static_cast<int>(t)));
         }
+        frequent.sort_quick();
         
-        entry->positions.push(pos);
+        const size_t bench_terms = frequent.size() < 32 ? frequent.size() : 32;
+        SimpleVector<unsigned char> encoded[32];
+        for (size_t i = 0; i < bench_terms; i++) {
+            TermData* data = index_data.get(frequent.get(i).ref);
+            unsigned char buf[10];
+            int prev = -1;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                int doc = data->docs.get(j).doc_id;
+                size_t len = write_varint(buf, doc - prev);
+                for (size_t k = 0; k < len; k++) encoded[i].push(buf[k]);
+                prev = doc;
+            }
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < 10; round++) {
+            for (size_t a = 0; a < bench_terms; a++) {
+                for (size_t b = a + 1; b < bench_terms; b++) {
+                    const unsigned char* pa = &encoded[a].get(0);
+                    const unsigned char* pb = &encoded[b].get(0);
+                    const unsigned char* end_a = pa + encoded[a].size();
+                    const unsigned char* end_b = pb + encoded[b].size();
+                    long long da = static_cast<long long>(read_varint(pa)) - 1;
+                    long long db = static_cast<long long>(read_varint(pb)) - 1;
+                    while (true) {
+                        if (da == db) {
+                            stats.bench_matches++;
+                            if (pa == end_a || pb == end_b) break;
+                            da += read_varint(pa);
+                            db += read_varint(pb);
+                        } else if (da < db) {
+                            if (pa == end_a) break;
+                            da += read_varint(pa);
+                        } else {
+                            if (pb == end_b) break;
+                            db += read_varint(pb);
+                        }
+                    }
+                }
+            }
+        }
+        auto finish = std::chrono::steady_clock::now();
+        stats.intersect_ms = std::chrono::duration<double, std::milli>(finish - start).count();
+        return stats;
     }
     
     void sort_all() {
@@ -123,60 +439,351 @@ public:
         }
     }
     
+    // Перенумерация документов бисекцией графа (doc_reorder.h): похожие по
+    // словарю документы получают соседние номера. Списки уже отсортированы.
+    void reorder_docs() {
+        std::cerr << "Перенумерация документов..." << std::endl;
+        reorder_before = gap_stats();
+        
+        SimpleVector<int> offsets;
+        for (int d = 0; d <= doc_count; d++) {
+            offsets.push(0);
+        }
+        for (size_t t = 0; t < index_data.size(); t++) {
+            TermData* data = index_data.get(t);
+            if (!data || data->doc_count < 2) continue;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                offsets.get(data->docs.get(j).doc_id + 1)++;
+            }
+        }
+        for (int d = 0; d < doc_count; d++) {
+            offsets.get(d + 1) += offsets.get(d);
+        }
+        
+        SimpleVector<int> terms;
+        SimpleVector<int> fill;
+        terms.reserve(offsets.get(doc_count) + 1);
+        for (int i = 0; i < offsets.get(doc_count); i++) {
+            terms.push(0);
+        }
+        terms.push(0);
+        for (int d = 0; d < doc_count; d++) {
+            fill.push(offsets.get(d));
+        }
+        for (size_t t = 0; t < index_data.size(); t++) {
+            TermData* data = index_data.get(t);
+            if (!data || data->doc_count < 2) continue;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                terms.get(fill.get(data->docs.get(j).doc_id)++) = static_cast<int>(t);
+            }
+        }
+        
+        SimpleVector<int> order;
+        GraphBisection bisection(&offsets.get(0), &terms.get(0), static_cast<int>(index_data.size()));
+        bisection.run(doc_count, order);
+        
+        SimpleVector<int> new_id;
+        for (int d = 0; d < doc_count; d++) {
+            new_id.push(0);
+        }
+        for (int i = 0; i < doc_count; i++) {
+            new_id.get(order.get(i)) = i;
+        }
+        
+        SimpleVector<DocKey> keys;
+        for (size_t t = 0; t < index_data.size(); t++) {
+            TermData* data = index_data.get(t);
+            if (!data) continue;
+            keys.clear();
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                keys.push(DocKey(new_id.get(data->docs.get(j).doc_id), static_cast<int>(j)));
+            }
+            keys.sort_quick();
+            
+            SimpleVector<DocEntry> sorted;
+            sorted.reserve(keys.size());
+            for (size_t j = 0; j < keys.size(); j++) {
+                sorted.push(DocEntry(keys.get(j).doc_id));
+                sorted.get(j).positions.swap(data->docs.get(keys.get(j).index).positions);
+            }
+            data->docs.swap(sorted);
+        }
+        
+        SimpleVector<char*> names;
+        for (int i = 0; i < doc_count; i++) {
+            names.push(doc_names.get(order.get(i)));
+        }
+        doc_names.swap(names);
+        
+        reorder_after = gap_stats();
+        reordered = true;
+        
+        std::cerr << "Списки (varint d-gap): " << reorder_before.varint_bytes << " -> "
+                  << reorder_after.varint_bytes << " байт" << std::endl;
+        std::cerr << "Пересечения частых терминов: " << reorder_before.intersect_ms << " -> "
+                  << reorder_after.intersect_ms << " мс" << std::endl;
+    }
+    
+    // Почти-дубликаты (near_dup.h) либо выбрасываются из индекса с
+    // перенумерацией оставшихся документов, либо только перечисляются
+    // в duplicates.txt.
+    void deduplicate() {
+        finish_sketch();
+        while (static_cast<int>(has_signature.size()) < doc_count) {
+            has_signature.push(0);
+            for (int i = 0; i < MINHASH_SIZE; i++) signatures.push(0);
+        }
+        
+        SimpleVector<int> canonical;
+        SimpleVector<float> similarity;
+        NearDuplicateFinder finder;
+        finder.find(signatures, has_signature, doc_count, canonical, similarity);
+        
+        for (int d = 0; d < doc_count; d++) {
+            if (canonical.get(d) == d) continue;
+            const char* name = doc_names.get(d);
+            const char* original = doc_names.get(canonical.get(d));
+            size_t len = strlen(name) + strlen(original) + 32;
+            char* line = static_cast<char*>(malloc(len));
+            snprintf(line, len, "%s\t%s\t%.3f", name, original, similarity.get(d));
+            duplicate_report.push(line);
+            duplicates_found++;
+        }
+        
+        std::cerr << "Почти-дубликатов: " << duplicates_found << std::endl;
+        if (options.dedup != DEDUP_DROP || duplicates_found == 0) return;
+        
+        SimpleVector<int> new_id;
+        int kept = 0;
+        for (int d = 0; d < doc_count; d++) {
+            new_id.push(canonical.get(d) == d ? kept++ : -1);
+        }
+        
+        for (size_t t = 0; t < index_data.size(); t++) {
+            TermData* data = index_data.get(t);
+            if (!data) continue;
+            SimpleVector<DocEntry> live;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                DocEntry& entry = data->docs.get(j);
+                int id = new_id.get(entry.doc_id);
+                if (id < 0) {
+                    removed_postings++;
+                    removed_positions += entry.positions.size();
+                    continue;
+                }
+                live.push(DocEntry(id));
+                live.get(live.size() - 1).positions.swap(entry.positions);
+            }
+            data->docs.swap(live);
+            data->doc_count = static_cast<int>(data->docs.size());
+        }
+        
+        SimpleVector<char*> names;
+        for (int d = 0; d < doc_count; d++) {
+            if (new_id.get(d) >= 0) {
+                names.push(doc_names.get(d));
+            } else {
+                free(doc_names.get(d));
+            }
+        }
+        doc_names.swap(names);
+        doc_count = kept;
+        
+        std::cerr << "Удалено вхождений термин-документ: " << removed_postings
+                  << ", позиций: " << removed_positions << std::endl;
+    }
+    
+    // Прямой индекс (forward_index.h): для каждого документа номера терминов
+    // в порядке lexicon.bin и их частоты, плюс длины документов.
+    void save_forward(const char* out_dir, SimpleVector<TermRef>& vocab) {
+        SimpleVector<int> row_start;
+        for (int d = 0; d <= doc_count; d++) {
+            row_start.push(0);
+        }
+        for (size_t i = 0; i < vocab.size(); i++) {
+            TermData* data = index_data.get(vocab.get(i).term_id);
+            if (!data) continue;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                row_start.get(data->docs.get(j).doc_id + 1)++;
+            }
+        }
+        for (int d = 0; d < doc_count; d++) {
+            row_start.get(d + 1) += row_start.get(d);
+        }
+        
+        int total = row_start.get(doc_count);
+        SimpleVector<uint32_t> ids;
+        SimpleVector<uint32_t> tfs;
+        SimpleVector<int> fill;
+        ids.reserve(total + 1);
+        tfs.reserve(total + 1);
+        for (int i = 0; i <= total; i++) {
+            ids.push(0);
+            tfs.push(0);
+        }
+        for (int d = 0; d < doc_count; d++) {
+            fill.push(row_start.get(d));
+        }
+        
+        uint32_t ordinal = 0;
+        for (size_t i = 0; i < vocab.size(); i++) {
+            TermData* data = index_data.get(vocab.get(i).term_id);
+            if (!data || data->docs.size() == 0) continue;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                DocEntry& entry = data->docs.get(j);
+                int slot = fill.get(entry.doc_id)++;
+                ids.get(slot) = ordinal;
+                tfs.get(slot) = static_cast<uint32_t>(entry.positions.size());
+            }
+            ordinal++;
+        }
+        
+        ForwardWriter writer;
+        for (int d = 0; d < doc_count; d++) {
+            int from = row_start.get(d);
+            writer.add_row(&ids.get(from), &tfs.get(from), row_start.get(d + 1) - from);
+        }
+        
+        char path[512];
+        snprintf(path, sizeof(path), "%s/forward.bin", out_dir);
+        if (!writer.write(path)) {
+            std::cerr << "Ошибка записи forward.bin" << std::endl;
+        }
+    }
+    
+    // Необязательные этапы после построения и сортировки списков.
+    void postprocess() {
+        if (options.dedup != DEDUP_OFF) deduplicate();
+        if (options.reorder_docs) reorder_docs();
+    }
+    
     void save(const char* out_dir) {
         _mkdir(out_dir);
         
-        SimpleVector<TermInfo> vocab;
+        SimpleVector<TermRef> vocab;
+        vocab.reserve(term_to_id.size());
         for (auto it = term_to_id.begin(); it != term_to_id.end(); ++it) {
-            TermInfo info(it->key, it->value);
-            if (it->value < static_cast<int>(index_data.size()) && index_data.get(it->value)) {
-                info.doc_count = index_data.get(it->value)->doc_count;
-            }
-            vocab.push(info);
+            vocab.push(TermRef(it->key, it->value));
+        }
+        if (vocab.size() > 1) {
+            sort_terms(&vocab.get(0), vocab.size(), 0);
         }
-
-        vocab.sort_quick();
         
         char vocab_path[512];
         char data_path[512];
         snprintf(vocab_path, sizeof(vocab_path), "%s/vocabulary.txt", out_dir);
         snprintf(data_path, sizeof(data_path), "%s/index_data.bin", out_dir);
         
-        FILE* vocab_file = fopen(vocab_path, "w");
-        FILE* data_file = fopen(data_path, "wb");
+        BufferedWriter vocab_file;
+        BufferedWriter data_file;
         
-        if (!vocab_file || !data_file) {
+        if (!vocab_file.open(vocab_path) || !data_file.open(data_path)) {
             std::cerr << "Ошибка создания файлов" << std::endl;
             return;
         }
         
-        long offset = 0;
+        LexiconWriter lexicon;
+        lexicon.reserve(vocab.size());
+        RoaringFileWriter bitmaps(static_cast<uint32_t>(doc_names.size()));
+        TrigramFileWriter trigrams;
+        CompletionWriter completions;
+        SimpleVector<int> term_docs;
+        SimpleVector<int> term_offsets;
+        
+        // Длины документов нужны границам блоков scores.bin раньше списков.
+        SimpleVector<uint32_t> doc_lengths;
+        doc_lengths.resize(doc_names.size());
         for (size_t i = 0; i < vocab.size(); i++) {
-            TermInfo& info = vocab.get(i);
-            TermData* data = index_data.get(info.term_id);
+            TermData* data = index_data.get(vocab.get(i).term_id);
             if (!data) continue;
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                doc_lengths.get(data->docs.get(j).doc_id) += data->docs.get(j).positions.size();
+            }
+        }
+        ScoreFileWriter scores(doc_lengths);
+        
+        size_t term_total = 0;
+        for (size_t i = 0; i < vocab.size(); i++) {
+            TermRef& ref = vocab.get(i);
+            TermData* data = index_data.get(ref.term_id);
+            if (!data || data->docs.size() == 0) continue;
+            term_total++;
             
-            fprintf(vocab_file, "%s\t%d\t%ld\n", info.term, info.doc_count, offset);
+            long long offset = data_file.offset();
+            size_t len = strlen(ref.term);
+            vocab_file.write(ref.term, len);
+            vocab_file.put('\t');
+            vocab_file.write_decimal(data->doc_count);
+            vocab_file.put('\t');
+            vocab_file.write_decimal(offset);
+            vocab_file.put('\n');
+            lexicon.add(ref.term, len, data->doc_count, offset);
+            trigrams.add(static_cast<uint32_t>(term_total - 1), ref.term, len);
+            completions.add(data->doc_count);
             
+            // Формат списка - postings.h.
             int doc_count = data->docs.size();
-            fwrite(&doc_count, sizeof(int), 1, data_file);
-            
+            term_docs.clear();
+            term_offsets.clear();
+            int pos_offset = 0;
+            term_offsets.push(pos_offset);
             for (int j = 0; j < doc_count; j++) {
-                DocEntry& entry = data->docs.get(j);
-                fwrite(&entry.doc_id, sizeof(int), 1, data_file);
-                
-                int pos_count = entry.positions.size();
-                fwrite(&pos_count, sizeof(int), 1, data_file);
-                for (int k = 0; k < pos_count; k++) {
-                    fwrite(&entry.positions.get(k), sizeof(int), 1, data_file);
+                term_docs.push(data->docs.get(j).doc_id);
+                pos_offset += data->docs.get(j).positions.size();
+                term_offsets.push(pos_offset);
+            }
+            if (is_dense_term(doc_count, doc_names.size())) {
+                bitmaps.add(static_cast<uint32_t>(term_total - 1), &term_docs.get(0), term_docs.size());
+            }
+            scores.add(&term_docs.get(0), &term_offsets.get(0), term_docs.size());
+            data_file.write_int(doc_count);
+            data_file.write(&term_docs.get(0), term_docs.size() * sizeof(int));
+            data_file.write(&term_offsets.get(0), term_offsets.size() * sizeof(int));
+            for (int j = 0; j < doc_count; j++) {
+                SimpleVector<int>& positions = data->docs.get(j).positions;
+                if (positions.size() > 0) {
+                    data_file.write(&positions.get(0), positions.size() * sizeof(int));
                 }
             }
-            
-            offset = ftell(data_file);
         }
         
-        fclose(vocab_file);
-        fclose(data_file);
+        if (!vocab_file.close() || !data_file.close()) {
+            std::cerr << "Ошибка записи индекса" << std::endl;
+        }
+        
+        char lexicon_path[512];
+        snprintf(lexicon_path, sizeof(lexicon_path), "%s/lexicon.bin", out_dir);
+        if (!lexicon.write(lexicon_path)) {
+            std::cerr << "Ошибка записи lexicon.bin" << std::endl;
+        }
+        
+        char bitmaps_path[512];
+        snprintf(bitmaps_path, sizeof(bitmaps_path), "%s/bitmaps.bin", out_dir);
+        if (!bitmaps.write(bitmaps_path)) {
+            std::cerr << "Ошибка записи bitmaps.bin" << std::endl;
+        }
+        
+        char trigrams_path[512];
+        snprintf(trigrams_path, sizeof(trigrams_path), "%s/trigrams.bin", out_dir);
+        if (!trigrams.write(trigrams_path)) {
+            std::cerr << "Ошибка записи trigrams.bin" << std::endl;
+        }
+        
+        char completions_path[512];
+        snprintf(completions_path, sizeof(completions_path), "%s/completions.bin", out_dir);
+        if (!completions.write(completions_path)) {
+            std::cerr << "Ошибка записи completions.bin" << std::endl;
+        }
+        
+        char scores_path[512];
+        snprintf(scores_path, sizeof(scores_path), "%s/scores.bin", out_dir);
+        if (!scores.write(scores_path)) {
+            std::cerr << "Ошибка записи scores.bin" << std::endl;
+        }
+        
+        if (options.forward_index) {
+            save_forward(out_dir, vocab);
+        }
         
         char doclist_path[512];
         snprintf(doclist_path, sizeof(doclist_path), "%s/documents.txt", out_dir);
@@ -188,49 +795,189 @@ public:
             fclose(doc_file);
         }
 
+        ZipfFit fit;
+        if (options.zipf_stats) {
+            fit = save_zipf(out_dir, vocab);
+        }
+        
+        if (options.dedup != DEDUP_OFF) {
+            char dup_path[512];
+            snprintf(dup_path, sizeof(dup_path), "%s/duplicates.txt", out_dir);
+            FILE* dup_file = fopen(dup_path, "w");
+            if (dup_file) {
+                for (size_t i = 0; i < duplicate_report.size(); i++) {
+                    fprintf(dup_file, "%s\n", duplicate_report.get(i));
+                }
+                fclose(dup_file);
+            }
+        }
+        
         char stats_path[512];
         snprintf(stats_path, sizeof(stats_path), "%s/stats.txt", out_dir);
         FILE* stats_file = fopen(stats_path, "w");
         if (stats_file) {
             fprintf(stats_file, "Документов: %d\n", doc_count);
-            fprintf(stats_file, "Уникальных терминов: %zu\n", term_to_id.size());
+            fprintf(stats_file, "Уникальных терминов: %zu\n", term_total);
+            if (options.zipf_stats) {
+                fprintf(stats_file, "Словоупотреблений: %lld\n", fit.total_occurrences);
+                fprintf(stats_file, "Параметр Ципфа s: %.4f\n", fit.s);
+                fprintf(stats_file, "Константа C: %.2f\n", fit.c);
+                fprintf(stats_file, "R^2: %.4f\n", fit.r_squared);
+            }
+            if (options.dedup != DEDUP_OFF) {
+                fprintf(stats_file, "Почти-дубликатов: %d\n", duplicates_found);
+                if (options.dedup == DEDUP_DROP) {
+                    fprintf(stats_file, "Удалено вхождений термин-документ: %lld\n", removed_postings);
+                    fprintf(stats_file, "Удалено позиций: %lld\n", removed_positions);
+                }
+            }
+            if (reordered) {
+                fprintf(stats_file, "Списки документов (varint d-gap), байт: %lld -> %lld\n",
+                        reorder_before.varint_bytes, reorder_after.varint_bytes);
+                fprintf(stats_file, "Бит на вхождение: %.3f -> %.3f\n",
+                        reorder_before.postings ? 8.0 * reorder_before.varint_bytes / reorder_before.postings : 0.0,
+                        reorder_after.postings ? 8.0 * reorder_after.varint_bytes / reorder_after.postings : 0.0);
+                fprintf(stats_file, "Пересечения частых терминов, мс: %.2f -> %.2f\n",
+                        reorder_before.intersect_ms, reorder_after.intersect_ms);
+            }
             fclose(stats_file);
         }
         
         std::cerr << "Индекс сохранён" << std::endl;
     }
     
+    // Объём памяти словаря, списков и позиций для stats.json.
+    void memory_usage(BuildProfile& profile) const {
+        size_t blocks, bytes;
+        term_to_id.memory_usage(blocks, bytes);
+        profile.dictionary.blocks += static_cast<long long>(blocks);
+        profile.dictionary.bytes += static_cast<long long>(bytes);
+        profile.dictionary.used += static_cast<long long>(bytes);
+        
+        profile.postings.add_vector(index_data);
+        for (size_t i = 0; i < index_data.size(); i++) {
+            const TermData* data = index_data.get(i);
+            if (!data) continue;
+            profile.postings.add(sizeof(TermData), sizeof(TermData));
+            profile.postings.add_vector(data->docs);
+            for (size_t j = 0; j < data->docs.size(); j++) {
+                profile.positions.add_vector(data->docs.get(j).positions);
+            }
+        }
+        
+        profile.doc_names.add_vector(doc_names);
+        for (size_t i = 0; i < doc_names.size(); i++) {
+            if (doc_names.get(i)) {
+                size_t len = strlen(doc_names.get(i)) + 1;
+                profile.doc_names.add(len, len);
+            }
+        }
+    }
+    
+    const char* doc_name(int id) const { return doc_names.get(id); }
+    long long occurrence_amount() const { return occurrences; }
     int doc_amount() const { return doc_count; }
-    int term_amount() const { return term_to_id.size(); }
+    int term_amount() const {
+        int total = 0;
+        for (size_t i = 0; i < index_data.size(); i++) {
+            if (index_data.get(i) && index_data.get(i)->docs.size() > 0) total++;
+        }
+        return total;
+    }
 };
 
+// Время этапов, память и производительность построения - stats.json рядом
+// со stats.txt.
+void save_profile(const char* out_dir, const BoolIndexer& indexer, BuildProfile& profile) {
+    profile.documents = indexer.doc_amount();
+    profile.occurrences = indexer.occurrence_amount();
+    profile.terms = indexer.term_amount();
+    
+    char path[512];
+    snprintf(path, sizeof(path), "%s/stats.json", out_dir);
+    if (!profile.write(path)) {
+        std::cerr << "Ошибка записи stats.json" << std::endl;
+    }
+}
+
+inline bool is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Строки вида "термин поз [поз ...]". Файл читается через отображение за один
+// проход; для повторяющегося подряд термина номер не ищется заново.
+// Термины от LEXICON_MAX_TERM байт пропускаются: lexicon.bin их не хранит,
+// а урезанные они совпали бы с другими.
 void process_file(const char* path, int doc_id, BoolIndexer& indexer) {
-    FILE* file = fopen(path, "r");
-    if (!file) {
+    MappedFile file;
+    if (!file.open(path)) {
         std::cerr << "Не могу открыть: " << path << std::endl;
         return;
     }
     
-    char line[4096];
-    while (fgets(line, sizeof(line), file)) {
-        size_t len = strlen(line);
-        if (len > 0 && line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-        }
+    const char* p = file.data();
+    const char* end = p + file.size();
+    const char* last_term = nullptr;
+    size_t last_len = 0;
+    int term_id = -1;
+    int too_long = 0;
+    
+    while (p < end) {
+        while (p < end && is_separator(*p)) p++;
+        const char* term = p;
+        while (p < end && !is_separator(*p) && *p != '\n') p++;
+        size_t len = p - term;
+        bool resolved = false;
         
-        char* term = strtok(line, " \t");
-        char* pos_str = strtok(nullptr, " \t");
+        if (len >= LEXICON_MAX_TERM) {
+            too_long++;
+            while (p < end && *p != '\n') p++;
+            if (p < end) p++;
+            continue;
+        }
         
-        while (pos_str) {
-            int pos = atoi(pos_str);
-            if (pos > 0) {
-                indexer.add_occurrence(term, doc_id, pos);
+        while (p < end && *p != '\n') {
+            if (is_separator(*p)) {
+                p++;
+                continue;
+            }
+            
+            bool negative = false;
+            if (*p == '-' || *p == '+') {
+                negative = *p == '-';
+                p++;
             }
-            pos_str = strtok(nullptr, " \t");
+            int pos = 0;
+            while (p < end && *p >= '0' && *p <= '9') {
+                pos = pos * 10 + (*p - '0');
+                p++;
+            }
+            while (p < end && !is_separator(*p) && *p != '\n') p++;
+            
+            if (negative || pos <= 0 || len == 0) continue;
+            
+            if (!resolved) {
+                bool same = last_term && len == last_len;
+                for (size_t i = 0; same && i < len; i++) {
+                    same = term[i] == last_term[i];
+                }
+                if (!same) {
+                    term_id = indexer.term_id(term, len);
+                    last_term = term;
+                    last_len = len;
+                }
+                resolved = true;
+            }
+            indexer.add_occurrence(term_id, doc_id, pos);
         }
+        
+        if (p < end) p++;
     }
     
-    fclose(file);
+    if (too_long > 0) {
+        std::cerr << "Пропущено терминов длиннее " << LEXICON_MAX_TERM - 1 << " байт: "
+                  << too_long << " (" << path << ")" << std::endl;
+    }
 }
 
 void build_from_dir(const char* dir_path, const char* out_dir, BoolIndexer& indexer) {
@@ -302,15 +1049,860 @@ void build_from_dir(const char* dir_path, const char* out_dir, BoolIndexer& inde
     std::cerr << "Всего: " << files.size() << " документов" << std::endl;
 }
 
+static const int MERGE_FACTOR = 4;
+
+int count_documents(const char* docs_path) {
+    FILE* file = fopen(docs_path, "r");
+    if (!file) return 0;
+    int count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        int id;
+        if (sscanf(line, "%d\t", &id) == 1 && id + 1 > count) count = id + 1;
+    }
+    fclose(file);
+    return count;
+}
+
+void load_doc_names(const char* docs_path, SimpleVector<char*>& names) {
+    FILE* file = fopen(docs_path, "r");
+    if (!file) return;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        int id;
+        char name[256];
+        if (sscanf(line, "%d\t%255[^\n]", &id, name) == 2) {
+            while (static_cast<int>(names.size()) <= id) {
+                names.push(nullptr);
+            }
+            char* copy = static_cast<char*>(malloc(strlen(name) + 1));
+            strcpy(copy, name);
+            names.get(id) = copy;
+        }
+    }
+    fclose(file);
+}
+
+void free_doc_names(SimpleVector<char*>& names) {
+    for (size_t i = 0; i < names.size(); i++) {
+        if (names.get(i)) free(names.get(i));
+    }
+    names.clear();
+}
+
+// Индекс, построенный целиком, становится сегментом "." при первом обновлении.
+bool open_manifest(const char* index_dir, SegmentManifest& manifest) {
+    if (manifest.load(index_dir)) return true;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/lexicon.bin", index_dir);
+    FILE* probe = fopen(path, "rb");
+    if (probe) {
+        fclose(probe);
+    } else if (!segment_outdated(index_dir, ".")) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/documents.txt", index_dir);
+    manifest.segments.push(SegmentInfo(".", count_documents(path)));
+    return true;
+}
+
+void load_deletions(const char* index_dir, const SegmentInfo& info, DeletionBitmap& deleted) {
+    char path[512];
+    deletions_path(path, sizeof(path), index_dir, info);
+    deleted.load(path, info.doc_count);
+}
+
+void remove_deletions(const char* index_dir, const SegmentInfo& info) {
+    char path[512];
+    deletions_path(path, sizeof(path), index_dir, info);
+    remove(path);
+}
+
+// Удаления сегмента s записываются в файл поколения generation; в manifest
+// они попадают только в памяти, на диск - вместе с остальными изменениями.
+// Прежний вариант сегмента добавляется в retired.
+bool stage_deletions(const char* index_dir, SegmentManifest& manifest, size_t s, const DeletionBitmap& deleted,
+                     int generation, SimpleVector<SegmentInfo>& retired) {
+    SegmentInfo& info = manifest.segments.get(s);
+    SegmentInfo staged = info;
+    staged.deletions = generation;
+    char path[512];
+    deletions_path(path, sizeof(path), index_dir, staged);
+    if (!deleted.save(path)) {
+        std::cerr << "Ошибка записи " << path << std::endl;
+        return false;
+    }
+    retired.push(info);
+    info = staged;
+    return true;
+}
+
+// Откат stage_deletions, если segments.txt записать не удалось.
+void discard_deletions(const char* index_dir, SegmentManifest& manifest, SimpleVector<SegmentInfo>& retired) {
+    for (size_t i = 0; i < retired.size(); i++) {
+        for (size_t s = 0; s < manifest.segments.size(); s++) {
+            SegmentInfo& info = manifest.segments.get(s);
+            if (strcmp(info.name, retired.get(i).name) != 0) continue;
+            remove_deletions(index_dir, info);
+            info = retired.get(i);
+        }
+    }
+    retired.clear();
+}
+
+void remove_segment(const char* index_dir, const SegmentInfo& info) {
+    for (size_t i = 0; i < sizeof(SEGMENT_FILES) / sizeof(SEGMENT_FILES[0]); i++) {
+        char path[512];
+        segment_path(path, sizeof(path), index_dir, info.name, SEGMENT_FILES[i]);
+        remove(path);
+    }
+    remove_deletions(index_dir, info);
+    if (strcmp(info.name, ".") != 0) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", index_dir, info.name);
+        _rmdir(path);
+    }
+}
+
+// Полная перестройка поверх сегментированного индекса: прежние сегменты
+// и файлы удалений больше не нужны. Возвращает поколение прежнего
+// segments.txt (0, если его не было).
+int clear_segments(const char* index_dir) {
+    remove_deletions(index_dir, SegmentInfo(".", 0));
+    SegmentManifest manifest;
+    if (!manifest.load(index_dir)) return 0;
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        const SegmentInfo& info = manifest.segments.get(s);
+        if (strcmp(info.name, ".") == 0) {
+            remove_deletions(index_dir, info);
+        } else {
+            remove_segment(index_dir, info);
+        }
+    }
+    return manifest.generation;
+}
+
+// Списки сегмента прежнего формата (только vocabulary.txt или lexicon.bin
+// версии 2, позиции вперемешку с номерами документов) переписываются
+// в текущем формате в папку out_dir: lexicon.bin и index_data.bin.
+bool convert_segment(const char* index_dir, const char* segment, const char* out_dir) {
+    char vocab_path[512], old_path[512], data_path[512], lexicon_path[512];
+    segment_path(vocab_path, sizeof(vocab_path), index_dir, segment, "vocabulary.txt");
+    segment_path(old_path, sizeof(old_path), index_dir, segment, "index_data.bin");
+    snprintf(data_path, sizeof(data_path), "%s/index_data.bin", out_dir);
+    snprintf(lexicon_path, sizeof(lexicon_path), "%s/lexicon.bin", out_dir);
+
+    FILE* vocab_file = fopen(vocab_path, "r");
+    if (!vocab_file) return false;
+    MappedFile old_data;
+    BufferedWriter data_file;
+    if (!old_data.open(old_path) || !data_file.open(data_path)) {
+        fclose(vocab_file);
+        return false;
+    }
+
+    const int* words = reinterpret_cast<const int*>(old_data.data());
+    const int* end = words + old_data.size() / sizeof(int);
+    LexiconWriter lexicon;
+    PostingListWriter list;
+    bool ok = true;
+    char line[1024];
+    char term[256];
+    while (ok && fgets(line, sizeof(line), vocab_file)) {
+        int doc_count;
+        long long offset;
+        if (sscanf(line, "%255[^\t]\t%d\t%lld", term, &doc_count, &offset) != 3) continue;
+        if (offset < 0 || static_cast<size_t>(offset) + sizeof(int) > old_data.size()) {
+            ok = false;
+            break;
+        }
+
+        const int* p = words + offset / sizeof(int);
+        int n = *p++;
+        list.clear();
+        for (int j = 0; j < n; j++) {
+            if (p + 2 > end || p + 2 + p[1] > end) {
+                ok = false;
+                break;
+            }
+            list.add(p[0], p + 2, p[1]);
+            p += 2 + p[1];
+        }
+        lexicon.add(term, strlen(term), doc_count, data_file.offset());
+        list.write(data_file);
+    }
+    fclose(vocab_file);
+    old_data.close();
+
+    if (!data_file.close()) ok = false;
+    return ok && lexicon.write(lexicon_path);
+}
+
+// Все сегменты прежнего формата переписываются; поколение увеличивается,
+// чтобы запущенный поиск перечитал индекс.
+
+struct MergeSource {
+    Lexicon lexicon;
+    MappedFile data;
+    DeletionBitmap deleted;
+    ForwardIndex forward;
+    SimpleVector<int> remap;
+    SimpleVector<int> term_remap;
+    Lexicon::Cursor* cursor;
+    long long matched;
+
+    MergeSource() : cursor(nullptr), matched(-1) {}
+    ~MergeSource() { delete cursor; }
+};
+
+// Сливает сегменты [first, last) в новый сегмент, выбрасывая удалённые документы.
+bool merge_segments(const char* index_dir, SegmentManifest& manifest, size_t first, size_t last) {
+    char name[64];
+    snprintf(name, sizeof(name), "seg_%06d", manifest.generation + 1);
+    // Папка короче буферов путей к файлам в ней: имя файла не урезается.
+    char out_dir[448];
+    if (snprintf(out_dir, sizeof(out_dir), "%s/%s", index_dir, name) >= static_cast<int>(sizeof(out_dir))) {
+        std::cerr << "Слишком длинный путь к индексу: " << index_dir << std::endl;
+        return false;
+    }
+    _mkdir(out_dir);
+
+    size_t count = last - first;
+    MergeSource* sources = new MergeSource[count];
+    SimpleVector<char*> merged_names;
+    bool ok = true;
+    bool with_forward = true;
+
+    for (size_t s = 0; s < count && ok; s++) {
+        const SegmentInfo& info = manifest.segments.get(first + s);
+        MergeSource& src = sources[s];
+        char path[512];
+
+        ok = open_segment_lexicon(index_dir, info.name, src.lexicon);
+        segment_path(path, sizeof(path), index_dir, info.name, "index_data.bin");
+        ok = ok && (src.data.open(path) || src.lexicon.size() == 0);
+        if (!ok) {
+            std::cerr << "Не удалось открыть сегмент " << info.name << std::endl;
+            break;
+        }
+        load_deletions(index_dir, info, src.deleted);
+        segment_path(path, sizeof(path), index_dir, info.name, "forward.bin");
+        if (with_forward && src.forward.open(path) && static_cast<int>(src.forward.size()) == info.doc_count) {
+            for (size_t t = 0; t < src.lexicon.size(); t++) {
+                src.term_remap.push(-1);
+            }
+        } else {
+            with_forward = false;
+        }
+
+        SimpleVector<char*> names;
+        segment_path(path, sizeof(path), index_dir, info.name, "documents.txt");
+        load_doc_names(path, names);
+        for (int d = 0; d < info.doc_count; d++) {
+            if (src.deleted.is_deleted(d)) {
+                src.remap.push(-1);
+                continue;
+            }
+            src.remap.push(static_cast<int>(merged_names.size()));
+            const char* doc = d < static_cast<int>(names.size()) && names.get(d) ? names.get(d) : "?";
+            char* copy = static_cast<char*>(malloc(strlen(doc) + 1));
+            strcpy(copy, doc);
+            merged_names.push(copy);
+        }
+        free_doc_names(names);
+        src.cursor = new Lexicon::Cursor(src.lexicon, 0);
+    }
+
+    char vocab_path[512], data_path[512], lexicon_path[512];
+    snprintf(vocab_path, sizeof(vocab_path), "%s/vocabulary.txt", out_dir);
+    snprintf(data_path, sizeof(data_path), "%s/index_data.bin", out_dir);
+    snprintf(lexicon_path, sizeof(lexicon_path), "%s/lexicon.bin", out_dir);
+    BufferedWriter vocab_file;
+    BufferedWriter data_file;
+    if (ok && (!vocab_file.open(vocab_path) || !data_file.open(data_path))) {
+        std::cerr << "Ошибка создания файлов" << std::endl;
+        ok = false;
+    }
+
+    LexiconWriter lexicon;
+    PostingListWriter postings;
+    RoaringFileWriter bitmaps(static_cast<uint32_t>(merged_names.size()));
+    TrigramFileWriter trigrams;
+    CompletionWriter completions;
+    char term[LEXICON_MAX_TERM];
+    int term_count = 0;
+
+    // Длины документов для scores.bin - по спискам живых документов.
+    SimpleVector<uint32_t> merged_lengths;
+    merged_lengths.resize(merged_names.size());
+    for (size_t s = 0; s < count && ok; s++) {
+        MergeSource& src = sources[s];
+        for (size_t id = 0; id < src.lexicon.size(); id++) {
+            PostingList list;
+            if (!list.open(src.data, src.lexicon.offset(id))) continue;
+            for (PostingCursor cursor(list); cursor.valid(); cursor.next()) {
+                int new_id = src.remap.get(cursor.doc());
+                if (new_id < 0) continue;
+                int pos_count;
+                cursor.positions(pos_count);
+                merged_lengths.get(new_id) += pos_count;
+            }
+        }
+    }
+    ScoreFileWriter scores(merged_lengths);
+
+    while (ok) {
+        int best = -1;
+        for (size_t s = 0; s < count; s++) {
+            Lexicon::Cursor* c = sources[s].cursor;
+            if (!c->valid()) continue;
+            if (best < 0 || compare_terms(c->term(), c->length(), sources[best].cursor->term(),
+                                          sources[best].cursor->length()) < 0) {
+                best = static_cast<int>(s);
+            }
+        }
+        if (best < 0) break;
+
+        size_t term_len = sources[best].cursor->length();
+        memcpy(term, sources[best].cursor->term(), term_len + 1);
+
+        postings.clear();
+        for (size_t s = 0; s < count; s++) {
+            MergeSource& src = sources[s];
+            Lexicon::Cursor* c = src.cursor;
+            src.matched = -1;
+            if (!c->valid() || compare_terms(c->term(), c->length(), term, term_len) != 0) continue;
+            src.matched = static_cast<long long>(c->id());
+
+            PostingList list;
+            if (!list.open(src.data, src.lexicon.offset(c->id()))) {
+                std::cerr << "Повреждён список термина " << term << std::endl;
+                ok = false;
+                break;
+            }
+            for (PostingCursor cursor(list); cursor.valid(); cursor.next()) {
+                int new_id = src.remap.get(cursor.doc());
+                if (new_id < 0) continue;
+                int pos_count;
+                const int* positions = cursor.positions(pos_count);
+                postings.add(new_id, positions, pos_count);
+            }
+            c->next();
+        }
+        if (!ok) break;
+        int doc_count = postings.size();
+        if (doc_count == 0) continue;
+
+        long long offset = data_file.offset();
+        vocab_file.write(term, term_len);
+        vocab_file.put('\t');
+        vocab_file.write_decimal(doc_count);
+        vocab_file.put('\t');
+        vocab_file.write_decimal(offset);
+        vocab_file.put('\n');
+        lexicon.add(term, term_len, doc_count, offset);
+        postings.write(data_file);
+        bitmaps.add(static_cast<uint32_t>(term_count), postings.doc_ids(), doc_count);
+        trigrams.add(static_cast<uint32_t>(term_count), term, term_len);
+        completions.add(doc_count);
+        scores.add(postings.doc_ids(), postings.position_offsets(), doc_count);
+        if (with_forward) {
+            for (size_t s = 0; s < count; s++) {
+                if (sources[s].matched >= 0) sources[s].term_remap.get(sources[s].matched) = term_count;
+            }
+        }
+        term_count++;
+    }
+
+    if (!vocab_file.close() || !data_file.close()) ok = false;
+    if (ok) ok = lexicon.write(lexicon_path);
+    if (ok) {
+        char bitmaps_path[512];
+        snprintf(bitmaps_path, sizeof(bitmaps_path), "%s/bitmaps.bin", out_dir);
+        ok = bitmaps.write(bitmaps_path);
+    }
+    if (ok) {
+        char trigrams_path[512];
+        snprintf(trigrams_path, sizeof(trigrams_path), "%s/trigrams.bin", out_dir);
+        ok = trigrams.write(trigrams_path);
+    }
+    if (ok) {
+        char completions_path[512];
+        snprintf(completions_path, sizeof(completions_path), "%s/completions.bin", out_dir);
+        ok = completions.write(completions_path);
+    }
+    if (ok) {
+        char scores_path[512];
+        snprintf(scores_path, sizeof(scores_path), "%s/scores.bin", out_dir);
+        ok = scores.write(scores_path);
+    }
+
+    // Порядок терминов при слиянии сохраняется, поэтому строки прямого
+    // индекса остаются отсортированными после замены номеров.
+    if (ok && with_forward) {
+        ForwardWriter forward;
+        SimpleVector<uint32_t> ids;
+        SimpleVector<uint32_t> tfs;
+        for (size_t s = 0; s < count; s++) {
+            MergeSource& src = sources[s];
+            for (size_t d = 0; d < src.remap.size(); d++) {
+                if (src.remap.get(d) < 0) continue;
+                ids.clear();
+                tfs.clear();
+                ForwardIndex::Row row = src.forward.row(d);
+                while (row.next()) {
+                    ids.push(static_cast<uint32_t>(src.term_remap.get(row.term())));
+                    tfs.push(row.tf());
+                }
+                forward.add_row(ids.size() ? &ids.get(0) : nullptr, tfs.size() ? &tfs.get(0) : nullptr, ids.size());
+            }
+        }
+        char forward_path[512];
+        snprintf(forward_path, sizeof(forward_path), "%s/forward.bin", out_dir);
+        ok = forward.write(forward_path);
+    }
+
+    if (ok) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/documents.txt", out_dir);
+        FILE* doc_file = fopen(path, "w");
+        if (doc_file) {
+            for (size_t i = 0; i < merged_names.size(); i++) {
+                fprintf(doc_file, "%zu\t%s\n", i, merged_names.get(i));
+            }
+            fclose(doc_file);
+        }
+
+        snprintf(path, sizeof(path), "%s/stats.txt", out_dir);
+        FILE* stats_file = fopen(path, "w");
+        if (stats_file) {
+            fprintf(stats_file, "Документов: %zu\n", merged_names.size());
+            fprintf(stats_file, "Уникальных терминов: %d\n", term_count);
+            fclose(stats_file);
+        }
+    }
+
+    delete[] sources;
+
+    if (!ok) {
+        free_doc_names(merged_names);
+        remove_segment(index_dir, SegmentInfo(name, 0));
+        return false;
+    }
+
+    // Если живых документов не осталось, сегменты просто убираются из списка.
+    bool empty = merged_names.size() == 0;
+    if (empty) remove_segment(index_dir, SegmentInfo(name, 0));
+
+    SegmentManifest updated;
+    updated.generation = manifest.generation + 1;
+    for (size_t i = 0; i < manifest.segments.size(); i++) {
+        if (i == first && !empty) {
+            updated.segments.push(SegmentInfo(name, static_cast<int>(merged_names.size())));
+        }
+        if (i < first || i >= last) {
+            updated.segments.push(manifest.segments.get(i));
+        }
+    }
+    free_doc_names(merged_names);
+    if (!updated.save(index_dir)) {
+        if (!empty) remove_segment(index_dir, SegmentInfo(name, 0));
+        return false;
+    }
+
+    if (empty) {
+        std::cerr << "Удалено пустых сегментов: " << count << std::endl;
+    } else {
+        std::cerr << "Слито сегментов: " << count << " -> " << name << std::endl;
+    }
+    for (size_t i = first; i < last; i++) {
+        remove_segment(index_dir, manifest.segments.get(i));
+    }
+    manifest = updated;
+    return true;
+}
+
+// Сегмент s прежнего формата переписывается во временную папку, которая
+// затем сливается сама с собой: слияние строит и bitmaps.bin, trigrams.bin,
+// completions.bin, scores.bin и подменяет сегмент одной записью
+// segments.txt. До этой записи в списке остаётся прежний сегмент.
+bool upgrade_segment(const char* index_dir, SegmentManifest& manifest, size_t s) {
+    SegmentInfo original = manifest.segments.get(s);
+    char name[64];
+    snprintf(name, sizeof(name), "seg_%06d", manifest.generation + 1);
+    char out_dir[448];
+    if (snprintf(out_dir, sizeof(out_dir), "%s/%s", index_dir, name) >= static_cast<int>(sizeof(out_dir))) {
+        std::cerr << "Слишком длинный путь к индексу: " << index_dir << std::endl;
+        return false;
+    }
+    _mkdir(out_dir);
+
+    SegmentInfo converted(name, original.doc_count);
+    bool ok = convert_segment(index_dir, original.name, out_dir);
+    if (ok) {
+        SimpleVector<char*> names;
+        char path[512];
+        segment_path(path, sizeof(path), index_dir, original.name, "documents.txt");
+        load_doc_names(path, names);
+        snprintf(path, sizeof(path), "%s/documents.txt", out_dir);
+        FILE* doc_file = fopen(path, "w");
+        if (doc_file) {
+            for (size_t i = 0; i < names.size(); i++) {
+                fprintf(doc_file, "%zu\t%s\n", i, names.get(i) ? names.get(i) : "?");
+            }
+            ok = fclose(doc_file) == 0;
+        } else {
+            ok = false;
+        }
+        free_doc_names(names);
+    }
+    if (ok) {
+        DeletionBitmap deleted;
+        load_deletions(index_dir, original, deleted);
+        char path[512];
+        deletions_path(path, sizeof(path), index_dir, converted);
+        ok = deleted.deleted_count() == 0 || deleted.save(path);
+    }
+    if (!ok) {
+        remove_segment(index_dir, converted);
+        return false;
+    }
+
+    manifest.generation++;
+    manifest.segments.get(s) = converted;
+    if (!merge_segments(index_dir, manifest, s, s + 1)) {
+        manifest.generation--;
+        manifest.segments.get(s) = original;
+        remove_segment(index_dir, converted);
+        return false;
+    }
+    remove_segment(index_dir, original);
+    return true;
+}
+
+bool upgrade_index(const char* index_dir) {
+    SegmentManifest manifest;
+    if (!open_manifest(index_dir, manifest)) {
+        std::cerr << "Индекс не найден: " << index_dir << std::endl;
+        return false;
+    }
+
+    int upgraded = 0;
+    size_t s = 0;
+    while (s < manifest.segments.size()) {
+        SegmentInfo info = manifest.segments.get(s);
+        if (!segment_outdated(index_dir, info.name)) {
+            s++;
+            continue;
+        }
+        size_t before = manifest.segments.size();
+        if (!upgrade_segment(index_dir, manifest, s)) {
+            std::cerr << "Не удалось обновить сегмент " << info.name << std::endl;
+            return false;
+        }
+        upgraded++;
+        // Сегмент без живых документов просто уходит из списка.
+        if (manifest.segments.size() == before) s++;
+    }
+    std::cerr << "Обновлено сегментов: " << upgraded << std::endl;
+    return true;
+}
+
+int segment_level(int live_docs) {
+    int level = 0;
+    while (live_docs >= MERGE_FACTOR) {
+        live_docs /= MERGE_FACTOR;
+        level++;
+    }
+    return level;
+}
+
+// Ступенчатая политика: MERGE_FACTOR соседних сегментов одного уровня сливаются
+// в один сегмент следующего уровня; сегменты, где удалено больше половины
+// документов, переписываются отдельно. При force всё сливается в один сегмент.
+void merge_policy(const char* index_dir, bool force) {
+    SegmentManifest manifest;
+    if (!open_manifest(index_dir, manifest)) {
+        std::cerr << "Индекс не найден: " << index_dir << std::endl;
+        return;
+    }
+    // Сегменты прежнего формата сливаются только после обновления.
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        if (segment_outdated(index_dir, manifest.segments.get(s).name)) {
+            if (!upgrade_index(index_dir) || !open_manifest(index_dir, manifest)) return;
+            break;
+        }
+    }
+
+    while (manifest.segments.size() > 0) {
+        size_t n = manifest.segments.size();
+        SimpleVector<int> live;
+        SimpleVector<int> deleted;
+        for (size_t i = 0; i < n; i++) {
+            DeletionBitmap bitmap;
+            load_deletions(index_dir, manifest.segments.get(i), bitmap);
+            live.push(manifest.segments.get(i).doc_count - bitmap.deleted_count());
+            deleted.push(bitmap.deleted_count());
+        }
+
+        size_t first = n, last = n;
+        if (force) {
+            if (n > 1 || deleted.get(0) > 0) {
+                first = 0;
+                last = n;
+            }
+        } else {
+            for (size_t i = 0; i < n && first == n; i++) {
+                if (deleted.get(i) * 2 > manifest.segments.get(i).doc_count) {
+                    first = i;
+                    last = i + 1;
+                }
+            }
+            for (size_t i = 0; i < n && first == n; i++) {
+                size_t j = i;
+                int level = segment_level(live.get(i));
+                while (j < n && segment_level(live.get(j)) == level) j++;
+                if (j - i >= static_cast<size_t>(MERGE_FACTOR)) {
+                    first = i;
+                    last = i + MERGE_FACTOR;
+                }
+            }
+        }
+        if (first == n) break;
+
+        if (!merge_segments(index_dir, manifest, first, last)) {
+            std::cerr << "Ошибка слияния сегментов" << std::endl;
+            break;
+        }
+        if (force) break;
+    }
+}
+
+void delete_documents(const char* index_dir, char** names, int count) {
+    SegmentManifest manifest;
+    if (!open_manifest(index_dir, manifest)) {
+        std::cerr << "Индекс не найден: " << index_dir << std::endl;
+        return;
+    }
+
+    int generation = manifest.generation + 1;
+    SimpleVector<SegmentInfo> retired;
+    int removed = 0;
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        const SegmentInfo& info = manifest.segments.get(s);
+        SimpleVector<char*> doc_names;
+        char path[512];
+        segment_path(path, sizeof(path), index_dir, info.name, "documents.txt");
+        load_doc_names(path, doc_names);
+
+        DeletionBitmap deleted;
+        load_deletions(index_dir, info, deleted);
+        int before = deleted.deleted_count();
+        for (size_t d = 0; d < doc_names.size(); d++) {
+            for (int k = 0; k < count; k++) {
+                if (doc_names.get(d) && strcmp(doc_names.get(d), names[k]) == 0) {
+                    deleted.mark(static_cast<int>(d));
+                }
+            }
+        }
+        free_doc_names(doc_names);
+
+        if (deleted.deleted_count() > before) {
+            if (!stage_deletions(index_dir, manifest, s, deleted, generation, retired)) {
+                discard_deletions(index_dir, manifest, retired);
+                return;
+            }
+            removed += deleted.deleted_count() - before;
+        }
+    }
+
+    if (retired.size() > 0) {
+        manifest.generation = generation;
+        if (!manifest.save(index_dir)) {
+            std::cerr << "Ошибка записи segments.txt" << std::endl;
+            discard_deletions(index_dir, manifest, retired);
+            return;
+        }
+        for (size_t i = 0; i < retired.size(); i++) remove_deletions(index_dir, retired.get(i));
+    }
+
+    std::cerr << "Удалено документов: " << removed << std::endl;
+}
+
+// Новые документы записываются отдельным сегментом; их прежние версии
+// в старых сегментах помечаются удалёнными.
+bool add_segment(const char* tokens_dir, const char* index_dir, const IndexOptions& options) {
+    _mkdir(index_dir);
+    SegmentManifest manifest;
+    open_manifest(index_dir, manifest);
+
+    BoolIndexer indexer(options);
+    BuildProfile profile;
+    build_from_dir(tokens_dir, index_dir, indexer);
+    profile.phase("build_from_dir");
+    if (indexer.doc_amount() == 0) {
+        std::cerr << "Нет новых документов" << std::endl;
+        return false;
+    }
+    indexer.memory_usage(profile);
+    indexer.sort_all();
+    profile.phase("sort_all");
+    indexer.postprocess();
+    profile.phase("postprocess");
+
+    char name[64];
+    snprintf(name, sizeof(name), "seg_%06d", manifest.generation + 1);
+    // Папка короче буферов путей к файлам в ней: имя файла не урезается.
+    char out_dir[448];
+    if (snprintf(out_dir, sizeof(out_dir), "%s/%s", index_dir, name) >= static_cast<int>(sizeof(out_dir))) {
+        std::cerr << "Слишком длинный путь к индексу: " << index_dir << std::endl;
+        return false;
+    }
+    indexer.save(out_dir);
+    profile.phase("save");
+    save_profile(out_dir, indexer, profile);
+
+    TermDict new_docs(4096);
+    for (int i = 0; i < indexer.doc_amount(); i++) {
+        new_docs.add(indexer.doc_name(i), i);
+    }
+
+    // Старые версии документов и новый сегмент публикуются одной записью
+    // segments.txt: поиск не видит документ дважды ни в какой момент.
+    int generation = manifest.generation + 1;
+    SimpleVector<SegmentInfo> retired;
+    int replaced = 0;
+    for (size_t s = 0; s < manifest.segments.size(); s++) {
+        const SegmentInfo& info = manifest.segments.get(s);
+        SimpleVector<char*> doc_names;
+        char path[512];
+        segment_path(path, sizeof(path), index_dir, info.name, "documents.txt");
+        load_doc_names(path, doc_names);
+
+        DeletionBitmap deleted;
+        load_deletions(index_dir, info, deleted);
+        int before = deleted.deleted_count();
+        for (size_t d = 0; d < doc_names.size(); d++) {
+            if (doc_names.get(d) && new_docs.contains(doc_names.get(d))) {
+                deleted.mark(static_cast<int>(d));
+            }
+        }
+        free_doc_names(doc_names);
+
+        if (deleted.deleted_count() > before) {
+            if (!stage_deletions(index_dir, manifest, s, deleted, generation, retired)) {
+                discard_deletions(index_dir, manifest, retired);
+                remove_segment(index_dir, SegmentInfo(name, 0));
+                return false;
+            }
+            replaced += deleted.deleted_count() - before;
+        }
+    }
+
+    manifest.generation = generation;
+    manifest.segments.push(SegmentInfo(name, indexer.doc_amount()));
+    if (!manifest.save(index_dir)) {
+        std::cerr << "Ошибка записи segments.txt" << std::endl;
+        discard_deletions(index_dir, manifest, retired);
+        remove_segment(index_dir, SegmentInfo(name, 0));
+        return false;
+    }
+    for (size_t i = 0; i < retired.size(); i++) remove_deletions(index_dir, retired.get(i));
+
+    std::cerr << "Добавлен сегмент " << name << ": " << indexer.doc_amount()
+              << " документов, заменено " << replaced << std::endl;
+    return true;
+}
+
+IndexOptions parse_options(int argc, char* argv[], int first) {
+    IndexOptions options;
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--zipf") == 0) {
+            options.zipf_stats = true;
+        } else if (strcmp(argv[i], "--reorder") == 0) {
+            options.reorder_docs = true;
+        } else if (strcmp(argv[i], "--dedup") == 0) {
+            options.dedup = DEDUP_DROP;
+        } else if (strcmp(argv[i], "--dedup-tag") == 0) {
+            options.dedup = DEDUP_TAG;
+        } else if (strcmp(argv[i], "--forward") == 0) {
+            options.forward_index = true;
+        } else {
+            std::cerr << "Неизвестный параметр: " << argv[i] << std::endl;
+        }
+    }
+    return options;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 3) {
         std::cout << "=== Булев индексатор (ЛР6) ===\n";
-        std::cout << "Использование: " << argv[0] << " <папка_с_токенами> <выходная_папка>\n";
+        std::cout << "Использование: " << argv[0] << " <папка_с_токенами> <выходная_папка> [параметры]\n";
+        std::cout << "       " << argv[0] << " --add <папка_с_токенами> <папка_индекса> [параметры]\n";
+        std::cout << "       " << argv[0] << " --delete <папка_индекса> <документ>...\n";
+        std::cout << "       " << argv[0] << " --merge <папка_индекса>\n";
+        std::cout << "       " << argv[0] << " --upgrade <папка_индекса>   перевод сегментов прежнего формата\n";
+        std::cout << "Параметры:\n";
+        std::cout << "  --zipf      частоты терминов и закон Ципфа (zipf_data.csv, zipf_results.json)\n";
+        std::cout << "  --reorder   перенумерация документов для сжатия списков\n";
+        std::cout << "  --dedup     исключить почти-дубликаты (--dedup-tag: только duplicates.txt)\n";
+        std::cout << "  --forward   прямой индекс документ -> термины (forward.bin)\n";
         std::cout << "Пример: " << argv[0] << " tokens index\n";
         std::cout << "Для работы нужна папка с .tokens файлами\n";
         return 1;
     }
     
+    // Изменение существующего индекса - под блокировкой.
+    IndexLock lock;
+    const char* locked_dir = nullptr;
+    if (strcmp(argv[1], "--add") == 0 && argc >= 4) {
+        _mkdir(argv[3]);
+        locked_dir = argv[3];
+    } else if (strcmp(argv[1], "--delete") == 0 || strcmp(argv[1], "--merge") == 0 ||
+               strcmp(argv[1], "--upgrade") == 0) {
+        locked_dir = argv[2];
+    } else if (strncmp(argv[1], "--", 2) != 0) {
+        _mkdir(argv[2]);
+        locked_dir = argv[2];
+    }
+    if (locked_dir && !lock.acquire(locked_dir)) {
+        std::cerr << "Индекс занят другим процессом (" << lock.file() << ")" << std::endl;
+        return 1;
+    }
+    
+    if (strcmp(argv[1], "--add") == 0) {
+        if (argc < 4) {
+            std::cerr << "Нужны папка с токенами и папка индекса" << std::endl;
+            return 1;
+        }
+        if (!add_segment(argv[2], argv[3], parse_options(argc, argv, 4))) return 1;
+        
+        // Новый сегмент уже опубликован и виден поиску; слияние идёт здесь
+        // же, синхронно, и каждый его шаг публикуется отдельно.
+        merge_policy(argv[3], false);
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "--delete") == 0) {
+        if (argc < 4) {
+            std::cerr << "Нужны папка индекса и имена документов" << std::endl;
+            return 1;
+        }
+        delete_documents(argv[2], argv + 3, argc - 3);
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "--merge") == 0) {
+        merge_policy(argv[2], true);
+        return 0;
+    }
+    
+    if (strcmp(argv[1], "--upgrade") == 0) {
+        return upgrade_index(argv[2]) ? 0 : 1;
+    }
+    
     const char* input_dir = argv[1];
     const char* output_dir = argv[2];
     
@@ -318,18 +1910,40 @@ int main(int argc, char* argv[]) {
     std::cerr << "Входная папка: " << input_dir << std::endl;
     std::cerr << "Выходная папка: " << output_dir << std::endl;
     
-    BoolIndexer indexer;
+    int generation = clear_segments(output_dir);
+    
+    BoolIndexer indexer(parse_options(argc, argv, 3));
+    BuildProfile profile;
     build_from_dir(input_dir, output_dir, indexer);
+    profile.phase("build_from_dir");
+    indexer.memory_usage(profile);
     
     std::cerr << "\nСортировка индекса..." << std::endl;
     indexer.sort_all();
+    profile.phase("sort_all");
+    indexer.postprocess();
+    profile.phase("postprocess");
     
     std::cerr << "Сохранение индекса..." << std::endl;
     indexer.save(output_dir);
+    profile.phase("save");
+    save_profile(output_dir, indexer, profile);
+    
+    // segments.txt с новым поколением публикуется последним и у любого
+    // индекса: по поколению запущенный поиск замечает и перестройку
+    // того же размера (например, с --reorder).
+    SegmentManifest manifest;
+    manifest.generation = generation + 1;
+    manifest.segments.push(SegmentInfo(".", indexer.doc_amount()));
+    if (!manifest.save(output_dir)) {
+        std::cerr << "Ошибка записи segments.txt" << std::endl;
+        return 1;
+    }
     
     std::cerr << "\n=== Результаты ===\n";
     std::cerr << "Документов: " << indexer.doc_amount() << std::endl;
     std::cerr << "Уникальных терминов: " << indexer.term_amount() << std::endl;
+    std::cerr << "Время построения, с: " << profile.total_ms() / 1000.0 << std::endl;
     std::cerr << "Индекс сохранен в папке: " << output_dir << std::endl;
     
     return 0;
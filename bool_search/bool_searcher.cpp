@@ -4,8 +4,25 @@
 #include <cstring>
 #include <cstdlib>
 #include <cctype>
+#include <climits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include "simple_vector.h"
 #include "simple_hash.h"
+#include "mapped_file.h"
+#include "lexicon.h"
+#include "segments.h"
+#include "postings.h"
+#include "set_ops.h"
+#include "roaring.h"
+#include "ngram_index.h"
+#include "levenshtein.h"
+#include "completion.h"
+#include "scores.h"
+#include "query_cache.h"
 
 struct Posting {
     int doc_id;
@@ -23,114 +40,363 @@ struct Posting {
     }
 };
 
-struct TermIndex {
-    char term[256];
+struct Segment {
+    Lexicon lexicon;
+    DeletionBitmap deleted;
+    MappedFile data;
+    RoaringFile bitmaps;
+    TrigramFile trigrams;
+    CompletionFile completions;
+    ScoreFile scores;
+    int doc_base;
     int doc_count;
-    long offset;
     
-    TermIndex() : doc_count(0), offset(0) {
-        term[0] = '\0';
-    }
-    
-    bool operator<(const TermIndex& other) const {
+    Segment() : doc_base(0), doc_count(0) {}
+};
+
+static const size_t NGRAM_SCAN_RATIO = 4;
+static const size_t COMPLETION_TOP_K = 10;
+
+struct Completion {
+    char term[LEXICON_MAX_TERM];
+    long long count;
+
+    bool operator<(const Completion& other) const {
+        if (count != other.count) return count > other.count;
         return strcmp(term, other.term) < 0;
     }
 };
 
 class SearchIndex {
 private:
-    SimpleVector<TermIndex> terms;
+    SimpleVector<Segment*> segments;
     SimpleVector<char*> doc_names;
-    char data_path[512];
     int total_docs;
+    int live_docs;
+    double avg_length;
     
-public:
-    SearchIndex() : total_docs(0) {
-        data_path[0] = '\0';
-    }
-    
-    ~SearchIndex() {
-        for (size_t i = 0; i < doc_names.size(); i++) {
-            if (doc_names.get(i)) free(doc_names.get(i));
-        }
-    }
-    
-    bool load(const char* dir) {
-        snprintf(data_path, sizeof(data_path), "%s/index_data.bin", dir);
+    bool load_segment(const char* dir, const SegmentInfo& info) {
+        Segment* seg = new Segment();
+        segments.push(seg);
+        seg->doc_base = total_docs;
         
-        char vocab_path[512];
-        snprintf(vocab_path, sizeof(vocab_path), "%s/vocabulary.txt", dir);
-        
-        FILE* vocab_file = fopen(vocab_path, "r");
-        if (!vocab_file) {
-            std::cerr << "Не найден файл vocabulary.txt" << std::endl;
+        if (!open_segment_lexicon(dir, info.name, seg->lexicon)) {
+            if (segment_outdated(dir, info.name)) {
+                std::cerr << "Сегмент " << info.name << " в прежнем формате, обновите индекс: "
+                          << "bool_indexer --upgrade " << dir << std::endl;
+            } else {
+                std::cerr << "Не удалось загрузить словарь" << std::endl;
+            }
             return false;
         }
         
-        char line[1024];
-        while (fgets(line, sizeof(line), vocab_file)) {
-            TermIndex ti;
-            if (sscanf(line, "%255[^\t]\t%d\t%ld", ti.term, &ti.doc_count, &ti.offset) == 3) {
-                terms.push(ti);
-            }
+        // index_data.bin отображается в память один раз на всё время работы,
+        // курсоры читают списки прямо из отображения.
+        char data_path[512];
+        segment_path(data_path, sizeof(data_path), dir, info.name, "index_data.bin");
+        if (!seg->data.open(data_path)) {
+            std::cerr << "Не удалось открыть " << data_path << std::endl;
+            return false;
         }
-        fclose(vocab_file);
         
+        int doc_count = info.doc_count;
+        char line[1024];
         char docs_path[512];
-        snprintf(docs_path, sizeof(docs_path), "%s/documents.txt", dir);
+        segment_path(docs_path, sizeof(docs_path), dir, info.name, "documents.txt");
         FILE* docs_file = fopen(docs_path, "r");
         if (docs_file) {
             while (fgets(line, sizeof(line), docs_file)) {
                 int id;
                 char name[256];
                 if (sscanf(line, "%d\t%255[^\n]", &id, name) == 2) {
-                    while (static_cast<int>(doc_names.size()) <= id) {
+                    int global_id = seg->doc_base + id;
+                    while (static_cast<int>(doc_names.size()) <= global_id) {
                         doc_names.push(nullptr);
                     }
                     char* copy = static_cast<char*>(malloc(strlen(name) + 1));
                     strcpy(copy, name);
-                    doc_names.get(id) = copy;
-                    total_docs = id + 1;
+                    doc_names.get(global_id) = copy;
+                    if (id + 1 > doc_count) doc_count = id + 1;
                 }
             }
             fclose(docs_file);
         }
+        seg->doc_count = doc_count;
+        
+        char deleted_path[512];
+        deletions_path(deleted_path, sizeof(deleted_path), dir, info);
+        seg->deleted.load(deleted_path, doc_count);
+        
+        // bitmaps.bin необязателен: без него все термины читаются списками.
+        char bitmaps_path[512];
+        segment_path(bitmaps_path, sizeof(bitmaps_path), dir, info.name, "bitmaps.bin");
+        seg->bitmaps.open(bitmaps_path, static_cast<uint32_t>(doc_count));
+        
+        // trigrams.bin тоже необязателен: шаблоны тогда разбираются по словарю.
+        char trigrams_path[512];
+        segment_path(trigrams_path, sizeof(trigrams_path), dir, info.name, "trigrams.bin");
+        seg->trigrams.open(trigrams_path, static_cast<uint32_t>(seg->lexicon.size()));
+        
+        char completions_path[512];
+        segment_path(completions_path, sizeof(completions_path), dir, info.name, "completions.bin");
+        seg->completions.open(completions_path, static_cast<uint32_t>(seg->lexicon.size()));
+        
+        // Без scores.bin документы сегмента считаются средней длины.
+        char scores_path[512];
+        segment_path(scores_path, sizeof(scores_path), dir, info.name, "scores.bin");
+        seg->scores.open(scores_path, static_cast<uint32_t>(doc_count), static_cast<uint32_t>(seg->lexicon.size()));
+        
+        total_docs += doc_count;
+        live_docs += doc_count - seg->deleted.deleted_count();
+        return true;
+    }
+    
+public:
+    SearchIndex() : total_docs(0), live_docs(0), avg_length(1.0) {}
+    
+    ~SearchIndex() {
+        for (size_t i = 0; i < doc_names.size(); i++) {
+            if (doc_names.get(i)) free(doc_names.get(i));
+        }
+        for (size_t i = 0; i < segments.size(); i++) {
+            delete segments.get(i);
+        }
+    }
+    
+    bool load(const char* dir) {
+        SegmentManifest manifest;
+        if (!manifest.load(dir)) {
+            manifest.segments.push(SegmentInfo(".", 0));
+        }
+        
+        size_t term_total = 0;
+        for (size_t i = 0; i < manifest.segments.size(); i++) {
+            if (!load_segment(dir, manifest.segments.get(i))) return false;
+            term_total += segments.get(i)->lexicon.size();
+        }
         
-        std::cerr << "Загружено: " << terms.size() << " терминов, "
-                  << total_docs << " документов" << std::endl;
+        uint64_t length = 0;
+        long long scored_docs = 0;
+        for (size_t i = 0; i < segments.size(); i++) {
+            const Segment* seg = segments.get(i);
+            if (!seg->scores.is_open()) continue;
+            length += seg->scores.total_length();
+            scored_docs += seg->doc_count;
+        }
+        if (length > 0) avg_length = static_cast<double>(length) / scored_docs;
+        
+        std::cerr << "Загружено: " << term_total << " терминов, "
+                  << live_docs << " документов, "
+                  << segments.size() << " сегментов" << std::endl;
         return true;
     }
     
-    SimpleVector<int> get_docs(const char* term) {
+    size_t segment_count() const { return segments.size(); }
+    int segment_base(size_t s) const { return segments.get(s)->doc_base; }
+    int segment_size(size_t s) const { return segments.get(s)->doc_count; }
+    const DeletionBitmap& segment_deleted(size_t s) const { return segments.get(s)->deleted; }
+    const ScoreFile& segment_scores(size_t s) const { return segments.get(s)->scores; }
+    // Средняя длина документа (в вхождениях терминов) для BM25.
+    double average_length() const { return avg_length; }
+    
+    // Список термина в сегменте s без копирования.
+    bool postings(size_t s, const char* term, PostingList& list) const {
+        const Segment* seg = segments.get(s);
+        size_t id;
+        if (!seg->lexicon.find(term, id)) return false;
+        return list.open(seg->data, seg->lexicon.offset(id));
+    }
+    
+    // Термины сегмента s под шаблон со звёздочками (номера в словаре).
+    // Если начало шаблона до * отсекает мало словаря (*град*, *ость),
+    // кандидатов даёт trigrams.bin, и проверяются только они. Проверка
+    // кандидата дороже шага курсора, отсюда запас в NGRAM_SCAN_RATIO раз.
+    void expand(size_t s, const char* pattern, SimpleVector<size_t>& ids) const {
+        const Segment* seg = segments.get(s);
+        size_t first, last;
+        seg->lexicon.pattern_range(pattern, first, last);
+        SimpleVector<int> candidates;
+        if (seg->trigrams.candidates(pattern, (last - first) / NGRAM_SCAN_RATIO, candidates)) {
+            seg->lexicon.filter(pattern, candidates, ids);
+            return;
+        }
+        seg->lexicon.expand(pattern, ids);
+    }
+    
+    bool find_term(size_t s, const char* term, size_t& id) const {
+        return segments.get(s)->lexicon.find(term, id);
+    }
+    
+    bool postings_at(size_t s, size_t id, PostingList& list) const {
+        const Segment* seg = segments.get(s);
+        return list.open(seg->data, seg->lexicon.offset(id));
+    }
+    
+    // Есть ли у термина готовая карта в bitmaps.bin сегмента s.
+    bool has_bitmap(size_t s, const char* term) const {
+        const Segment* seg = segments.get(s);
+        size_t id, slot;
+        return seg->lexicon.find(term, id) && seg->bitmaps.contains(static_cast<uint32_t>(id), slot);
+    }
+    
+    // Множество документов термина в сегменте s (локальные номера).
+    void term_set(size_t s, const char* term, RoaringBitmap& out) const {
+        const Segment* seg = segments.get(s);
+        out.reset(static_cast<uint32_t>(seg->doc_count));
+        size_t id, slot;
+        if (!seg->lexicon.find(term, id)) return;
+        if (seg->bitmaps.contains(static_cast<uint32_t>(id), slot) && seg->bitmaps.load(slot, out)) return;
+        PostingList list;
+        if (list.open(seg->data, seg->lexicon.offset(id))) out.add_sorted(list.docs, list.count);
+    }
+    
+    // Оценка длины списка термина для планировщика (без учёта удалений).
+    long long term_cost(const char* term) const {
+        long long total = 0;
+        for (size_t s = 0; s < segments.size(); s++) {
+            const Segment* seg = segments.get(s);
+            size_t id;
+            if (seg->lexicon.find(term, id)) total += seg->lexicon.doc_count(id);
+        }
+        return total;
+    }
+    
+    // Термины сегмента s на расстоянии правки не больше k от word.
+    void expand_fuzzy(size_t s, const char* word, int k, SimpleVector<size_t>& ids) const {
+        LevenshteinAutomaton automaton(word, k);
+        SimpleVector<int> distances;
+        fuzzy_expand(segments.get(s)->lexicon, automaton, ids, distances);
+    }
+    
+    long long fuzzy_cost(const char* word, int k) const {
+        long long total = 0;
+        SimpleVector<size_t> ids;
+        for (size_t s = 0; s < segments.size(); s++) {
+            expand_fuzzy(s, word, k, ids);
+            for (size_t i = 0; i < ids.size(); i++) total += segments.get(s)->lexicon.doc_count(ids.get(i));
+        }
+        return total;
+    }
+    
+    // Ближайший к word термин индекса: меньше правок, при равенстве - чаще.
+    bool suggest(const char* word, char* out, size_t out_size) const {
+        LevenshteinAutomaton automaton(word, MAX_FUZZY_DISTANCE);
+        SimpleVector<size_t> ids;
+        SimpleVector<int> distances;
+        int best_dist = MAX_FUZZY_DISTANCE + 1;
+        long long best_count = 0;
+        char term[LEXICON_MAX_TERM];
+        for (size_t s = 0; s < segments.size(); s++) {
+            const Segment* seg = segments.get(s);
+            fuzzy_expand(seg->lexicon, automaton, ids, distances);
+            for (size_t i = 0; i < ids.size(); i++) {
+                int d = distances.get(i);
+                if (d == 0 || d > best_dist) continue;
+                seg->lexicon.term(ids.get(i), term, sizeof(term));
+                long long count = term_cost(term);
+                if (d < best_dist || count > best_count) {
+                    best_dist = d;
+                    best_count = count;
+                    snprintf(out, out_size, "%s", term);
+                }
+            }
+        }
+        return best_dist <= MAX_FUZZY_DISTANCE;
+    }
+    
+    // k самых частых терминов с началом prefix, частоты суммарные по всем
+    // сегментам. Кандидаты - m лучших каждого сегмента; термин вне них
+    // встречается в сегменте не чаще его m-го (и при равенстве стоит после
+    // него по алфавиту), так что не обгонит k-го, если тот не меньше суммы
+    // этих границ. Иначе m удваивается.
+    void complete(const char* prefix, size_t k, SimpleVector<Completion>& out) const {
+        out.clear();
+        if (k == 0) return;
+        SimpleVector<size_t> firsts, lasts;
+        for (size_t s = 0; s < segments.size(); s++) {
+            size_t first, last;
+            segments.get(s)->lexicon.prefix_range(prefix, first, last);
+            firsts.push(first);
+            lasts.push(last);
+        }
+        
+        SimpleVector<uint32_t> ids;
+        for (size_t m = k; ; m *= 2) {
+            out.clear();
+            TermDict seen(64);
+            long long bound = 0;
+            char bound_term[LEXICON_MAX_TERM] = "";
+            bool exhausted = true;
+            for (size_t s = 0; s < segments.size(); s++) {
+                const Segment* seg = segments.get(s);
+                seg->completions.top(seg->lexicon, firsts.get(s), lasts.get(s), m, ids);
+                for (size_t i = 0; i < ids.size(); i++) {
+                    Completion c;
+                    seg->lexicon.term(ids.get(i), c.term, sizeof(c.term));
+                    if (seen.contains(c.term)) continue;
+                    seen.add(c.term, 0);
+                    c.count = term_cost(c.term);
+                    out.push(c);
+                }
+                if (ids.size() < m) continue;
+                // Сегмент отдал не все термины с этим началом.
+                exhausted = false;
+                char term[LEXICON_MAX_TERM];
+                seg->lexicon.term(ids.get(m - 1), term, sizeof(term));
+                bound += seg->lexicon.doc_count(ids.get(m - 1));
+                if (strcmp(term, bound_term) > 0) snprintf(bound_term, sizeof(bound_term), "%s", term);
+            }
+            out.sort();
+            if (exhausted) break;
+            if (out.size() >= k) {
+                const Completion& kth = out.get(k - 1);
+                if (kth.count > bound || (kth.count == bound && strcmp(kth.term, bound_term) <= 0)) break;
+            }
+        }
+        out.resize(out.size() < k ? out.size() : k);
+    }
+    
+    // Сумма длин списков всех терминов под шаблон.
+    long long pattern_cost(const char* pattern) const {
+        long long total = 0;
+        SimpleVector<size_t> ids;
+        for (size_t s = 0; s < segments.size(); s++) {
+            const Segment* seg = segments.get(s);
+            expand(s, pattern, ids);
+            for (size_t i = 0; i < ids.size(); i++) total += seg->lexicon.doc_count(ids.get(i));
+        }
+        return total;
+    }
+    
+    SimpleVector<int> get_docs(const char* term) const {
         SimpleVector<int> result;
-        for (size_t i = 0; i < terms.size(); i++) {
-            if (strcmp(terms.get(i).term, term) == 0) {
-                FILE* file = fopen(data_path, "rb");
-                if (!file) return result;
-                
-                fseek(file, terms.get(i).offset, SEEK_SET);
-                
-                int doc_count;
-                fread(&doc_count, sizeof(int), 1, file);
-                
-                for (int j = 0; j < doc_count; j++) {
-                    int doc_id, pos_count;
-                    fread(&doc_id, sizeof(int), 1, file);
-                    result.push(doc_id);
-                    
-                    fread(&pos_count, sizeof(int), 1, file);
-                    fseek(file, pos_count * sizeof(int), SEEK_CUR);
+        for (size_t s = 0; s < segments.size(); s++) {
+            PostingList list;
+            if (!postings(s, term, list)) continue;
+            
+            const Segment* seg = segments.get(s);
+            result.reserve(result.size() + list.count);
+            for (PostingCursor cursor(list); cursor.valid(); cursor.next()) {
+                if (!seg->deleted.is_deleted(cursor.doc())) {
+                    result.push(seg->doc_base + cursor.doc());
                 }
-                
-                fclose(file);
-                break;
             }
         }
         
         return result;
     }
     
-    const char* doc_name(int id) {
+    bool is_live(int id) const {
+        for (size_t s = segments.size(); s-- > 0;) {
+            const Segment* seg = segments.get(s);
+            if (id >= seg->doc_base) {
+                return id - seg->doc_base < seg->doc_count && !seg->deleted.is_deleted(id - seg->doc_base);
+            }
+        }
+        return false;
+    }
+    
+    const char* doc_name(int id) const {
         if (id >= 0 && id < static_cast<int>(doc_names.size())) {
             return doc_names.get(id);
         }
@@ -138,236 +404,1922 @@ public:
     }
     
     int doc_total() const { return total_docs; }
+    int live_total() const { return live_docs; }
 };
 
-SimpleVector<int> intersect(SimpleVector<int>& a, SimpleVector<int>& b) {
-    SimpleVector<int> res;
-    size_t i = 0, j = 0;
+// Вычисление по документам (document-at-a-time): каждый узел запроса -
+// итератор по возрастающим глобальным номерам, документы проходят от
+// листьев к корню по одному, промежуточные списки не строятся.
+static const int NO_DOC = INT_MAX;
 
-    a.sort();
-    b.sort();
-    
-    while (i < a.size() && j < b.size()) {
-        int d1 = a.get(i);
-        int d2 = b.get(j);
-        
-        if (d1 == d2) {
-            res.push(d1);
-            i++; j++;
-        } else if (d1 < d2) {
-            i++;
-        } else {
-            j++;
+class DocIterator {
+protected:
+    int current;
+
+public:
+    DocIterator() : current(-1) {}
+    virtual ~DocIterator() {}
+
+    int doc() const { return current; }
+    virtual void next() = 0;
+    // Переход к первому документу >= target.
+    virtual void advance(int target) = 0;
+};
+
+// Список термина по всем сегментам; удалённые документы пропускаются.
+class TermIterator : public DocIterator {
+private:
+    struct Part {
+        PostingCursor cursor;
+        int base;
+        const DeletionBitmap* deleted;
+
+        Part() : base(0), deleted(nullptr) {}
+        Part(const PostingList& list, int b, const DeletionBitmap* d) : cursor(list), base(b), deleted(d) {}
+    };
+
+    SimpleVector<Part> parts;
+    size_t part;
+
+    void settle() {
+        while (part < parts.size()) {
+            Part& p = parts.get(part);
+            if (p.deleted) {
+                while (p.cursor.valid() && p.deleted->is_deleted(p.cursor.doc())) p.cursor.next();
+            }
+            if (p.cursor.valid()) {
+                current = p.base + p.cursor.doc();
+                return;
+            }
+            part++;
         }
+        current = NO_DOC;
     }
-    
-    return res;
-}
 
-SimpleVector<int> unite(SimpleVector<int>& a, SimpleVector<int>& b) {
-    SimpleVector<int> res;
-    size_t i = 0, j = 0;
-    
-    a.sort();
-    b.sort();
-    
-    while (i < a.size() && j < b.size()) {
-        int d1 = a.get(i);
-        int d2 = b.get(j);
-        
-        if (d1 == d2) {
-            res.push(d1);
-            i++; j++;
-        } else if (d1 < d2) {
-            res.push(d1);
-            i++;
-        } else {
-            res.push(d2);
-            j++;
+public:
+    TermIterator(const SearchIndex& index, const char* term) : part(0) {
+        for (size_t s = 0; s < index.segment_count(); s++) {
+            PostingList list;
+            if (index.postings(s, term, list) && list.count > 0) {
+                const DeletionBitmap& deleted = index.segment_deleted(s);
+                parts.push(Part(list, index.segment_base(s), deleted.deleted_count() > 0 ? &deleted : nullptr));
+            }
         }
+        settle();
     }
-    
-    while (i < a.size()) {
-        res.push(a.get(i));
-        i++;
+
+    void next() {
+        if (current == NO_DOC) return;
+        parts.get(part).cursor.next();
+        settle();
     }
-    while (j < b.size()) {
-        res.push(b.get(j));
-        j++;
+
+    void advance(int target) {
+        if (target <= current) return;
+        while (part + 1 < parts.size() && parts.get(part + 1).base <= target) part++;
+        if (part < parts.size()) {
+            Part& p = parts.get(part);
+            p.cursor.seek(target - p.base);
+        }
+        settle();
     }
-    
-    return res;
-}
+};
 
-SimpleVector<int> complement(SimpleVector<int>& list, int total) {
-    SimpleVector<int> res;
-    int idx = 0;
-    
-    list.sort();
-    
-    for (int i = 0; i < total; i++) {
-        if (idx < static_cast<int>(list.size()) && list.get(idx) == i) {
-            idx++;
-        } else {
-            res.push(i);
+// Готовый отсортированный список: общее поддерево или результат ядер
+// set_ops.h.
+class ListIterator : public DocIterator {
+private:
+    SimpleVector<int> owned;
+    const int* items;
+    size_t count;
+    size_t index;
+
+    void settle() {
+        current = index < count ? items[index] : NO_DOC;
+    }
+
+public:
+    // Список остаётся у вызывающего.
+    ListIterator(const int* list, size_t n) : items(list), count(n), index(0) {
+        settle();
+    }
+
+    // Список переходит к итератору.
+    explicit ListIterator(SimpleVector<int>& list) : index(0) {
+        owned.swap(list);
+        items = owned.size() > 0 ? &owned.get(0) : nullptr;
+        count = owned.size();
+        settle();
+    }
+
+    void next() {
+        if (current == NO_DOC) return;
+        index++;
+        settle();
+    }
+
+    void advance(int target) {
+        if (target <= current) return;
+        index = gallop(items, index, count, target);
+        settle();
+    }
+};
+
+// Пересечение: самый редкий операнд предлагает кандидата, остальные
+// догоняют его через advance; кандидат из excluded отбрасывается.
+class AndIterator : public DocIterator {
+private:
+    SimpleVector<DocIterator*> children;
+    SimpleVector<DocIterator*> excluded;
+
+    void find_match(int target) {
+        while (target != NO_DOC) {
+            DocIterator* lead = children.get(0);
+            lead->advance(target);
+            target = lead->doc();
+            if (target == NO_DOC) break;
+
+            bool agree = true;
+            for (size_t i = 1; i < children.size(); i++) {
+                DocIterator* child = children.get(i);
+                child->advance(target);
+                if (child->doc() != target) {
+                    target = child->doc();
+                    agree = false;
+                    break;
+                }
+            }
+            if (!agree) continue;
+
+            bool rejected = false;
+            for (size_t i = 0; i < excluded.size(); i++) {
+                DocIterator* ex = excluded.get(i);
+                ex->advance(target);
+                if (ex->doc() == target) {
+                    rejected = true;
+                    break;
+                }
+            }
+            if (!rejected) {
+                current = target;
+                return;
+            }
+            target++;
         }
+        current = NO_DOC;
     }
-    
-    return res;
-}
 
-enum TokenType { WORD, AND, OR, NOT, LPAR, RPAR, END };
+public:
+    // children - по возрастанию оценки размера.
+    AndIterator(SimpleVector<DocIterator*>& positive, SimpleVector<DocIterator*>& negative) {
+        children.swap(positive);
+        excluded.swap(negative);
+        find_match(0);
+    }
+
+    ~AndIterator() {
+        for (size_t i = 0; i < children.size(); i++) delete children.get(i);
+        for (size_t i = 0; i < excluded.size(); i++) delete excluded.get(i);
+    }
+
+    void next() {
+        if (current != NO_DOC) find_match(current + 1);
+    }
+
+    void advance(int target) {
+        if (target > current) find_match(target);
+    }
+};
+
+class OrIterator : public DocIterator {
+private:
+    SimpleVector<DocIterator*> children;
+
+    void settle() {
+        current = NO_DOC;
+        for (size_t i = 0; i < children.size(); i++) {
+            if (children.get(i)->doc() < current) current = children.get(i)->doc();
+        }
+    }
+
+public:
+    OrIterator(SimpleVector<DocIterator*>& operands) {
+        children.swap(operands);
+        settle();
+    }
+
+    ~OrIterator() {
+        for (size_t i = 0; i < children.size(); i++) delete children.get(i);
+    }
+
+    void next() {
+        if (current == NO_DOC) return;
+        for (size_t i = 0; i < children.size(); i++) {
+            if (children.get(i)->doc() == current) children.get(i)->next();
+        }
+        settle();
+    }
+
+    void advance(int target) {
+        if (target <= current) return;
+        for (size_t i = 0; i < children.size(); i++) {
+            children.get(i)->advance(target);
+        }
+        settle();
+    }
+};
+
+// Живые документы, которых нет во вложенном итераторе.
+class NotIterator : public DocIterator {
+private:
+    DocIterator* inner;
+    const SearchIndex& index;
+    int total;
+
+    void settle(int from) {
+        for (int d = from; d < total; d++) {
+            if (!index.is_live(d)) continue;
+            inner->advance(d);
+            if (inner->doc() != d) {
+                current = d;
+                return;
+            }
+        }
+        current = NO_DOC;
+    }
+
+public:
+    NotIterator(DocIterator* it, const SearchIndex& idx, int from = 0)
+        : inner(it), index(idx), total(idx.doc_total()) {
+        settle(from);
+    }
+
+    ~NotIterator() {
+        delete inner;
+    }
+
+    void next() {
+        if (current != NO_DOC) settle(current + 1);
+    }
+
+    void advance(int target) {
+        if (target > current) settle(target);
+    }
+};
+
+// Фраза "a b c" (слова на соседних позициях) и a NEAR/k b (не дальше k
+// позиций в любом порядке). Сначала курсоры терминов пересекаются по
+// номерам документов, ведёт самый короткий список; позиции читаются только
+// у документов, где встретились все термины.
+class PositionalIterator : public DocIterator {
+private:
+    struct Part {
+        SimpleVector<PostingCursor> cursors;
+        SimpleVector<size_t> order;
+        int base;
+        const DeletionBitmap* deleted;
+
+        Part() : base(0), deleted(nullptr) {}
+    };
+
+    SimpleVector<Part*> parts;
+    size_t part;
+    bool phrase;
+    int distance;
+
+    // Слово j фразы стоит на позиции start + j для всех j.
+    static bool phrase_match(Part& p) {
+        size_t words = p.cursors.size();
+        size_t shortest = p.order.get(0);
+        int n;
+        const int* lead = p.cursors.get(shortest).positions(n);
+        SimpleVector<size_t> at;
+        at.resize(words);
+        for (int i = 0; i < n; i++) {
+            int start = lead[i] - static_cast<int>(shortest);
+            bool all = true;
+            for (size_t j = 0; j < words && all; j++) {
+                if (j == shortest) continue;
+                int m;
+                const int* pos = p.cursors.get(j).positions(m);
+                int target = start + static_cast<int>(j);
+                at.get(j) = gallop(pos, at.get(j), m, target);
+                if (at.get(j) == static_cast<size_t>(m)) return false;
+                all = pos[at.get(j)] == target;
+            }
+            if (all) return true;
+        }
+        return false;
+    }
+
+    // Совпадающие позиции - одно и то же вхождение (a NEAR/k a).
+    static bool near_match(Part& p, int k) {
+        int na, nb;
+        const int* a = p.cursors.get(0).positions(na);
+        const int* b = p.cursors.get(1).positions(nb);
+        int i = 0, j = 0;
+        while (i < na && j < nb) {
+            int gap = a[i] > b[j] ? a[i] - b[j] : b[j] - a[i];
+            if (gap <= k && a[i] != b[j]) return true;
+            if (a[i] <= b[j]) i++;
+            else j++;
+        }
+        return false;
+    }
+
+    bool find_match(Part& p) {
+        PostingCursor& lead = p.cursors.get(p.order.get(0));
+        while (lead.valid()) {
+            int doc = lead.doc();
+            bool all = true;
+            for (size_t i = 1; i < p.order.size(); i++) {
+                PostingCursor& c = p.cursors.get(p.order.get(i));
+                c.seek(doc);
+                if (!c.valid()) return false;
+                if (c.doc() != doc) {
+                    lead.seek(c.doc());
+                    all = false;
+                    break;
+                }
+            }
+            if (!all) continue;
+            if (!p.deleted || !p.deleted->is_deleted(doc)) {
+                if (phrase ? phrase_match(p) : near_match(p, distance)) return true;
+            }
+            lead.next();
+        }
+        return false;
+    }
+
+    void settle() {
+        while (part < parts.size()) {
+            Part& p = *parts.get(part);
+            if (find_match(p)) {
+                current = p.base + p.cursors.get(p.order.get(0)).doc();
+                return;
+            }
+            part++;
+        }
+        current = NO_DOC;
+    }
+
+public:
+    // k < 0 - фраза.
+    PositionalIterator(const SearchIndex& index, const SimpleVector<const char*>& words, int k)
+        : part(0), phrase(k < 0), distance(k) {
+        for (size_t s = 0; s < index.segment_count(); s++) {
+            Part* p = new Part();
+            for (size_t i = 0; i < words.size(); i++) {
+                PostingList list;
+                if (!index.postings(s, words.get(i), list) || list.count == 0) break;
+                p->cursors.push(PostingCursor(list));
+                size_t j = p->order.size();
+                p->order.push(i);
+                while (j > 0 && p->cursors.get(p->order.get(j - 1)).size() > list.count) {
+                    p->order.get(j) = p->order.get(j - 1);
+                    j--;
+                }
+                p->order.get(j) = i;
+            }
+            if (p->cursors.size() < words.size()) {
+                delete p;
+                continue;
+            }
+            const DeletionBitmap& deleted = index.segment_deleted(s);
+            p->base = index.segment_base(s);
+            p->deleted = deleted.deleted_count() > 0 ? &deleted : nullptr;
+            parts.push(p);
+        }
+        settle();
+    }
+
+    ~PositionalIterator() {
+        for (size_t i = 0; i < parts.size(); i++) delete parts.get(i);
+    }
+
+    void next() {
+        if (current == NO_DOC) return;
+        Part& p = *parts.get(part);
+        p.cursors.get(p.order.get(0)).next();
+        settle();
+    }
+
+    void advance(int target) {
+        if (target <= current) return;
+        while (part + 1 < parts.size() && parts.get(part + 1)->base <= target) part++;
+        if (part < parts.size()) {
+            Part& p = *parts.get(part);
+            p.cursors.get(p.order.get(0)).seek(target - p.base);
+        }
+        settle();
+    }
+};
+
+enum TokenType { WORD, PHRASE, NEAR, AND, OR, NOT, LPAR, RPAR, END };
 
 struct Token {
     TokenType type;
     char word[256];
-    
-    Token() : type(END) { word[0] = '\0'; }
-    Token(TokenType t) : type(t) { word[0] = '\0'; }
-    Token(const char* w) : type(WORD) {
+    int distance;
+
+    Token() : type(END), distance(0) { word[0] = '\0'; }
+    Token(TokenType t) : type(t), distance(0) { word[0] = '\0'; }
+    Token(const char* w) : type(WORD), distance(0) {
         strncpy(word, w, sizeof(word) - 1);
         word[sizeof(word) - 1] = '\0';
     }
 };
 
+enum NodeType { NODE_TERM, NODE_AND, NODE_OR, NODE_NOT, NODE_PHRASE, NODE_NEAR, NODE_PATTERN, NODE_FUZZY };
+
+// Узел дерева запроса. У AND после планирования операнды под NOT
+// перенесены в excluded и вычитаются из пересечения остальных. У фразы
+// и NEAR дети - термины в порядке запроса, distance - k из NEAR/k.
+// NODE_PATTERN - слово со звёздочками (стан*, ст*ция), в word шаблон.
+// NODE_FUZZY - слово~k: word без ~k, distance - допустимое число правок.
+struct QueryNode {
+    NodeType type;
+    char word[256];
+    SimpleVector<QueryNode*> children;
+    SimpleVector<QueryNode*> excluded;
+    char* key;
+    long long cost;
+    int distance;
+    bool shared;
+
+    QueryNode(NodeType t) : type(t), key(nullptr), cost(0), distance(0), shared(false) { word[0] = '\0'; }
+
+    ~QueryNode() {
+        for (size_t i = 0; i < children.size(); i++) delete children.get(i);
+        for (size_t i = 0; i < excluded.size(); i++) delete excluded.get(i);
+        free(key);
+    }
+};
+
 class QueryParser {
 private:
     const char* input;
     int pos;
+    int token_pos;
     Token current;
-    
+    bool implicit_or;
+    bool failed;
+
     void skip_spaces() {
         while (input[pos] && isspace(input[pos])) pos++;
     }
-    
+
     void next_token() {
         skip_spaces();
-        
+        token_pos = pos;
+
         if (!input[pos]) {
             current = Token(END);
             return;
         }
-        
+
         if (input[pos] == '(') {
             current = Token(LPAR);
             pos++;
             return;
         }
-        
+
         if (input[pos] == ')') {
             current = Token(RPAR);
             pos++;
             return;
         }
-        
+
         if (input[pos] == '&' && input[pos + 1] == '&') {
             current = Token(AND);
             pos += 2;
             return;
         }
-        
+
         if (input[pos] == '|' && input[pos + 1] == '|') {
             current = Token(OR);
             pos += 2;
             return;
         }
-        
+
         if (input[pos] == '!') {
             current = Token(NOT);
             pos++;
             return;
         }
-        
-        char buffer[256];
-        int i = 0;
-        while (input[pos] && !isspace(input[pos]) && 
-               input[pos] != '(' && input[pos] != ')' &&
-               input[pos] != '&' && input[pos] != '|' && input[pos] != '!') {
+
+        // Фраза - всё до закрывающей кавычки, слова разбирает parse_factor.
+        if (input[pos] == '"') {
+            current = Token(PHRASE);
+            pos++;
+            int i = 0;
+            while (input[pos] && input[pos] != '"') {
+                if (i < 255) current.word[i++] = tolower(input[pos]);
+                pos++;
+            }
+            current.word[i] = '\0';
+            if (input[pos] == '"') pos++;
+            return;
+        }
+
+        char buffer[256];
+        int i = 0;
+        while (input[pos] && !isspace(input[pos]) &&
+               input[pos] != '(' && input[pos] != ')' && input[pos] != '"' &&
+               input[pos] != '&' && input[pos] != '|' && input[pos] != '!') {
             if (i < 255) buffer[i++] = tolower(input[pos]);
             pos++;
         }
         buffer[i] = '\0';
+
+        int distance;
+        char tail;
+        if (sscanf(buffer, "near/%d%c", &distance, &tail) == 1 && distance >= 0) {
+            current = Token(NEAR);
+            current.distance = distance;
+            return;
+        }
         current = Token(buffer);
     }
-    
-    SimpleVector<int> parse_expr(SearchIndex& idx);
-    SimpleVector<int> parse_term(SearchIndex& idx);
-    SimpleVector<int> parse_factor(SearchIndex& idx);
-    
+
+    static QueryNode* term(const char* word) {
+        QueryNode* node = new QueryNode(NODE_TERM);
+        strcpy(node->word, word);
+        return node;
+    }
+
+    QueryNode* phrase(const char* text);
+    static QueryNode* fuzzy(const char* word);
+
+    // Печатается только первая ошибка, разбор доходит до конца запроса.
+    void fail(const char* message) {
+        if (!failed) std::cerr << "Ошибка: " << message << std::endl;
+        failed = true;
+    }
+
+    QueryNode* binary(NodeType type, QueryNode* left, QueryNode* right) {
+        if (!left || !right) {
+            fail("не хватает операнда");
+            delete left;
+            delete right;
+            return nullptr;
+        }
+        QueryNode* node = new QueryNode(type);
+        node->children.push(left);
+        node->children.push(right);
+        return node;
+    }
+
+    QueryNode* parse_expr();
+    QueryNode* parse_term();
+    QueryNode* parse_factor();
+    QueryNode* parse_near(QueryNode* left);
+
+    bool starts_operand() const {
+        return current.type == WORD || current.type == LPAR || current.type == PHRASE || current.type == NOT;
+    }
+
 public:
-    QueryParser(const char* query) : input(query), pos(0) {
+    // implicit_or - слова без операторов между ними объединяются через ||
+    // (свободный текст для ранжирования).
+    QueryParser(const char* query, bool or_by_default = false) : input(query), pos(0), token_pos(0), implicit_or(or_by_default), failed(false) {
         next_token();
     }
-    
-    SimpleVector<int> parse(SearchIndex& idx) {
-        return parse_expr(idx);
+
+    // Дерево запроса; nullptr, если в запросе нет терминов, не хватает
+    // операнда или скобки либо после разбора что-то осталось (NEAR/k после
+    // фразы, шаблона или слова~k, лишняя скобка): ответ на часть запроса
+    // хуже сообщения об ошибке.
+    QueryNode* parse() {
+        QueryNode* result = parse_expr();
+        if (!failed && current.type == NEAR) {
+            fail("NEAR/k соединяет только обычные слова");
+        } else if (!failed && current.type != END) {
+            std::cerr << "Ошибка: не разобран конец запроса: " << input + token_pos << std::endl;
+            failed = true;
+        }
+        if (!failed) return result;
+        delete result;
+        return nullptr;
     }
 };
 
-SimpleVector<int> QueryParser::parse_expr(SearchIndex& idx) {
-    SimpleVector<int> result = parse_term(idx);
-    
-    while (current.type == AND || current.type == OR) {
-        TokenType op = current.type;
+// && связывает сильнее ||, ! относится к ближайшему множителю.
+QueryNode* QueryParser::parse_expr() {
+    QueryNode* result = parse_term();
+
+    while (current.type == OR || (implicit_or && starts_operand())) {
+        if (current.type == OR) next_token();
+        result = binary(NODE_OR, result, parse_term());
+    }
+
+    return result;
+}
+
+QueryNode* QueryParser::parse_term() {
+    QueryNode* result = parse_factor();
+
+    while (current.type == AND) {
         next_token();
-        SimpleVector<int> right = parse_term(idx);
-        
-        if (op == AND) {
-            result = intersect(result, right);
-        } else {
-            result = unite(result, right);
-        }
+        result = binary(NODE_AND, result, parse_factor());
     }
-    
+
     return result;
 }
 
-SimpleVector<int> QueryParser::parse_term(SearchIndex& idx) {
+QueryNode* QueryParser::parse_factor() {
     if (current.type == NOT) {
         next_token();
-        SimpleVector<int> inner = parse_factor(idx);
-        return complement(inner, idx.doc_total());
+        QueryNode* inner = parse_factor();
+        if (!inner) {
+            fail("не хватает операнда");
+            return nullptr;
+        }
+        QueryNode* node = new QueryNode(NODE_NOT);
+        node->children.push(inner);
+        return node;
     }
-    
-    return parse_factor(idx);
-}
 
-SimpleVector<int> QueryParser::parse_factor(SearchIndex& idx) {
     if (current.type == LPAR) {
         next_token();
-        SimpleVector<int> result = parse_expr(idx);
+        QueryNode* result = parse_expr();
         if (current.type != RPAR) {
-            std::cerr << "Ошибка: ожидается ')'" << std::endl;
+            fail("ожидается ')'");
         } else {
             next_token();
         }
         return result;
     }
-    
+
+    if (current.type == PHRASE) {
+        QueryNode* node = phrase(current.word);
+        next_token();
+        return node;
+    }
+
+    // Шаблон и слово~k раскрываются только как отдельный операнд, во
+    // фразах и NEAR/k звёздочка и тильда остаются обычными символами.
+    if (current.type == WORD) {
+        QueryNode* node = fuzzy(current.word);
+        if (node) {
+            next_token();
+            return node;
+        }
+    }
+
+    if (current.type == WORD && strchr(current.word, '*')) {
+        QueryNode* node = new QueryNode(NODE_PATTERN);
+        strcpy(node->word, current.word);
+        next_token();
+        return node;
+    }
+
     if (current.type == WORD) {
-        SimpleVector<int> result = idx.get_docs(current.word);
+        QueryNode* node = term(current.word);
+        next_token();
+        return current.type == NEAR ? parse_near(node) : node;
+    }
+
+    return nullptr;
+}
+
+// Слова фразы через пробелы; из одного слова получается обычный термин.
+QueryNode* QueryParser::phrase(const char* text) {
+    QueryNode* node = new QueryNode(NODE_PHRASE);
+    char word[256];
+    int n;
+    while (sscanf(text, "%255s%n", word, &n) == 1) {
+        node->children.push(term(word));
+        text += n;
+    }
+    if (node->children.size() > 1) return node;
+    QueryNode* result = node->children.size() == 1 ? node->children.get(0) : nullptr;
+    node->children.clear();
+    delete node;
+    return result;
+}
+
+// слово~k или слово~ (k = MAX_FUZZY_DISTANCE); k больше предела урезается,
+// слово~0 - обычный термин. nullptr, если это не нечёткий запрос.
+QueryNode* QueryParser::fuzzy(const char* word) {
+    const char* tilde = strrchr(word, '~');
+    if (!tilde || tilde == word) return nullptr;
+    int distance = MAX_FUZZY_DISTANCE;
+    char tail;
+    if (tilde[1] && (sscanf(tilde + 1, "%d%c", &distance, &tail) != 1 || distance < 0)) return nullptr;
+    if (distance > MAX_FUZZY_DISTANCE) distance = MAX_FUZZY_DISTANCE;
+
+    QueryNode* node = new QueryNode(distance > 0 ? NODE_FUZZY : NODE_TERM);
+    size_t len = static_cast<size_t>(tilde - word);
+    memcpy(node->word, word, len);
+    node->word[len] = '\0';
+    node->distance = distance;
+    return node;
+}
+
+// a NEAR/k b связывает сильнее &&; a NEAR/3 b NEAR/2 c означает
+// (a NEAR/3 b) && (b NEAR/2 c).
+QueryNode* QueryParser::parse_near(QueryNode* left) {
+    QueryNode* result = nullptr;
+    while (current.type == NEAR) {
+        int distance = current.distance;
         next_token();
+        if (current.type != WORD) {
+            fail("после NEAR/k ожидается слово");
+            break;
+        }
+        QueryNode* right = term(current.word);
+        next_token();
+        QueryNode* node = new QueryNode(NODE_NEAR);
+        node->distance = distance;
+        node->children.push(left);
+        node->children.push(right);
+        result = result ? binary(NODE_AND, result, node) : node;
+        left = term(right->word);
+    }
+    if (!result) return left;
+    delete left;
+    return result;
+}
+
+// Упрощение дерева и порядок вычисления:
+//   - вложенные AND/OR сливаются, !!x заменяется на x;
+//   - повторы операндов одного AND/OR убираются, одинаковые поддеревья
+//     в разных местах запроса вычисляются один раз (shared);
+//   - операнды AND идут по возрастанию оценки размера (doc_count из
+//     словаря), a && !b выполняется как разность.
+class QueryPlanner {
+private:
+    const SearchIndex& index;
+    TermDict seen;
+
+    static void sort_nodes(SimpleVector<QueryNode*>& nodes, bool by_cost) {
+        for (size_t i = 1; i < nodes.size(); i++) {
+            QueryNode* node = nodes.get(i);
+            size_t j = i;
+            while (j > 0) {
+                QueryNode* prev = nodes.get(j - 1);
+                bool less = by_cost ? node->cost < prev->cost : strcmp(node->key, prev->key) < 0;
+                if (!less) break;
+                nodes.get(j) = prev;
+                j--;
+            }
+            nodes.get(j) = node;
+        }
+    }
+
+    static void make_key(QueryNode* node) {
+        char prefix[32];
+        if (node->type == NODE_NEAR) {
+            snprintf(prefix, sizeof(prefix), "~%d(", node->distance);
+        } else if (node->type == NODE_FUZZY) {
+            snprintf(prefix, sizeof(prefix), "f%d:", node->distance);
+        } else {
+            strcpy(prefix, node->type == NODE_TERM ? "w:" : node->type == NODE_PATTERN ? "p:" :
+                           node->type == NODE_AND ? "&(" : node->type == NODE_OR ? "|(" :
+                           node->type == NODE_PHRASE ? "\"(" : "!(");
+        }
+        size_t len = strlen(prefix) + 2;
+        bool leaf = node->type == NODE_TERM || node->type == NODE_PATTERN || node->type == NODE_FUZZY;
+        if (leaf) len += strlen(node->word);
+        for (size_t i = 0; i < node->children.size(); i++) {
+            len += strlen(node->children.get(i)->key) + 1;
+        }
+
+        char* key = static_cast<char*>(malloc(len));
+        strcpy(key, prefix);
+        if (leaf) {
+            strcat(key, node->word);
+        } else {
+            for (size_t i = 0; i < node->children.size(); i++) {
+                if (i > 0) strcat(key, ",");
+                strcat(key, node->children.get(i)->key);
+            }
+            strcat(key, ")");
+        }
+        free(node->key);
+        node->key = key;
+    }
+
+    QueryNode* simplify(QueryNode* node) {
+        if (node->type == NODE_TERM || node->type == NODE_PATTERN || node->type == NODE_FUZZY) {
+            make_key(node);
+            return node;
+        }
+
+        // Порядок слов фразы важен, NEAR симметричен.
+        if (node->type == NODE_PHRASE || node->type == NODE_NEAR) {
+            for (size_t i = 0; i < node->children.size(); i++) {
+                make_key(node->children.get(i));
+            }
+            if (node->type == NODE_NEAR) sort_nodes(node->children, false);
+            make_key(node);
+            return node;
+        }
+
+        if (node->type == NODE_NOT) {
+            QueryNode* inner = simplify(node->children.get(0));
+            if (inner->type == NODE_NOT) {
+                QueryNode* result = inner->children.get(0);
+                inner->children.clear();
+                node->children.clear();
+                delete inner;
+                delete node;
+                return result;
+            }
+            node->children.get(0) = inner;
+            make_key(node);
+            return node;
+        }
+
+        SimpleVector<QueryNode*> flat;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            QueryNode* child = simplify(node->children.get(i));
+            if (child->type == node->type) {
+                for (size_t j = 0; j < child->children.size(); j++) {
+                    flat.push(child->children.get(j));
+                }
+                child->children.clear();
+                delete child;
+            } else {
+                flat.push(child);
+            }
+        }
+
+        sort_nodes(flat, false);
+        node->children.clear();
+        for (size_t i = 0; i < flat.size(); i++) {
+            QueryNode* child = flat.get(i);
+            if (node->children.size() > 0 && strcmp(node->children.get(node->children.size() - 1)->key, child->key) == 0) {
+                delete child;
+            } else {
+                node->children.push(child);
+            }
+        }
+
+        if (node->children.size() == 1) {
+            QueryNode* result = node->children.get(0);
+            node->children.clear();
+            delete node;
+            return result;
+        }
+        make_key(node);
+        return node;
+    }
+
+    void count_subtrees(QueryNode* node) {
+        int count = 0;
+        seen.find(node->key, count);
+        seen.add(node->key, count + 1);
+        if (count > 0) return;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            count_subtrees(node->children.get(i));
+        }
+    }
+
+    void mark_shared(QueryNode* node) {
+        int count = 0;
+        seen.find(node->key, count);
+        node->shared = node->type != NODE_TERM && count > 1;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            mark_shared(node->children.get(i));
+        }
+    }
+
+    void estimate(QueryNode* node) {
+        long long total = index.live_total();
+        for (size_t i = 0; i < node->children.size(); i++) {
+            estimate(node->children.get(i));
+        }
+
+        if (node->type == NODE_TERM) {
+            node->cost = index.term_cost(node->word);
+        } else if (node->type == NODE_PATTERN) {
+            node->cost = index.pattern_cost(node->word);
+            if (node->cost > total) node->cost = total;
+        } else if (node->type == NODE_FUZZY) {
+            node->cost = index.fuzzy_cost(node->word, node->distance);
+            if (node->cost > total) node->cost = total;
+        } else if (node->type == NODE_PHRASE || node->type == NODE_NEAR) {
+            node->cost = node->children.get(0)->cost;
+            for (size_t i = 1; i < node->children.size(); i++) {
+                if (node->children.get(i)->cost < node->cost) node->cost = node->children.get(i)->cost;
+            }
+        } else if (node->type == NODE_NOT) {
+            node->cost = total - node->children.get(0)->cost;
+            if (node->cost < 0) node->cost = 0;
+        } else if (node->type == NODE_OR) {
+            node->cost = 0;
+            for (size_t i = 0; i < node->children.size(); i++) {
+                node->cost += node->children.get(i)->cost;
+            }
+            if (node->cost > total) node->cost = total;
+            sort_nodes(node->children, true);
+        } else {
+            SimpleVector<QueryNode*> positive;
+            for (size_t i = 0; i < node->children.size(); i++) {
+                QueryNode* child = node->children.get(i);
+                if (child->type == NODE_NOT) {
+                    node->excluded.push(child->children.get(0));
+                    child->children.clear();
+                    delete child;
+                } else {
+                    positive.push(child);
+                }
+            }
+            node->children.swap(positive);
+            sort_nodes(node->children, true);
+            sort_nodes(node->excluded, true);
+
+            if (node->children.size() > 0) {
+                node->cost = node->children.get(0)->cost;
+            } else {
+                node->cost = total;
+                for (size_t i = 0; i < node->excluded.size(); i++) {
+                    node->cost -= node->excluded.get(i)->cost;
+                }
+                if (node->cost < 0) node->cost = 0;
+            }
+        }
+    }
+
+public:
+    QueryPlanner(const SearchIndex& idx) : index(idx), seen(64) {}
+
+    QueryNode* plan(QueryNode* root) {
+        if (!root) return nullptr;
+        root = simplify(root);
+        count_subtrees(root);
+        mark_shared(root);
+        estimate(root);
+        return root;
+    }
+};
+
+class QueryExecutor {
+private:
+    const SearchIndex& index;
+    QueryCache* cache;
+    int range_lo;
+    int range_hi;
+    TermDict memo;
+    SimpleVector<SimpleVector<int>*> memo_results;
+    SimpleVector<int> buffer_a;
+    SimpleVector<int> buffer_b;
+
+    // Готовый список узла запоминается в кэше (если он есть).
+    DocIterator* remember(const QueryNode* node, SimpleVector<int>& result) {
+        if (cache) cache->put(node->key, result.size() > 0 ? &result.get(0) : nullptr, result.size());
+        return new ListIterator(result);
+    }
+
+    // Документы итератора из диапазона [range_lo, range_hi).
+    void drain(DocIterator* it, SimpleVector<int>& out) const {
+        it->advance(range_lo);
+        for (; it->doc() < range_hi; it->next()) {
+            out.push(it->doc());
+        }
+    }
+
+    // Локальный диапазон сегмента s внутри [range_lo, range_hi).
+    bool segment_range(size_t s, int& from, int& to) const {
+        int base = index.segment_base(s);
+        from = range_lo > base ? range_lo - base : 0;
+        to = index.segment_size(s);
+        if (range_hi - base < to) to = range_hi - base;
+        return from < to;
+    }
+
+    static bool terms_only(const SimpleVector<QueryNode*>& nodes) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes.get(i)->type != NODE_TERM) return false;
+        }
+        return true;
+    }
+
+    // Часть списка с номерами из [from, to).
+    static void clip(PostingList& list, int from, int to) {
+        size_t first = gallop(list.docs, 0, list.count, from);
+        size_t last = gallop(list.docs, first, list.count, to);
+        list.docs += first;
+        list.pos_offsets += first;
+        list.count = static_cast<int>(last - first);
+    }
+
+    // Отсортированные по длине списки терминов в сегменте (в пределах
+    // [from, to)); false, если какого-то термина нет, а нужны все.
+    bool segment_lists(size_t s, const SimpleVector<QueryNode*>& nodes, bool need_all, int from, int to,
+                       SimpleVector<PostingList>& lists) const {
+        lists.clear();
+        for (size_t i = 0; i < nodes.size(); i++) {
+            PostingList list;
+            bool found = index.postings(s, nodes.get(i)->word, list);
+            if (found) clip(list, from, to);
+            if (!found || list.count == 0) {
+                if (need_all) return false;
+                continue;
+            }
+            size_t j = lists.size();
+            lists.push(list);
+            while (j > 0 && lists.get(j - 1).count > list.count) {
+                lists.get(j) = lists.get(j - 1);
+                j--;
+            }
+            lists.get(j) = list;
+        }
+        return true;
+    }
+
+    bool segment_dense(size_t s, const QueryNode* node) const {
+        for (size_t i = 0; i < node->children.size(); i++) {
+            if (index.has_bitmap(s, node->children.get(i)->word)) return true;
+        }
+        for (size_t i = 0; i < node->excluded.size(); i++) {
+            if (index.has_bitmap(s, node->excluded.get(i)->word)) return true;
+        }
+        return false;
+    }
+
+    void segment_union(size_t s, const SimpleVector<QueryNode*>& terms, RoaringBitmap& out) const {
+        RoaringBitmap term;
+        RoaringBitmap tmp;
+        index.term_set(s, terms.get(0)->word, out);
+        for (size_t i = 1; i < terms.size(); i++) {
+            index.term_set(s, terms.get(i)->word, term);
+            RoaringBitmap::or_(out, term, tmp);
+            out.swap(tmp);
+        }
+    }
+
+    // AND/OR над терминами в сегменте s на множествах roaring.h.
+    void segment_set(size_t s, const QueryNode* node, RoaringBitmap& out) const {
+        if (node->type == NODE_OR) {
+            segment_union(s, node->children, out);
+            return;
+        }
+        RoaringBitmap term;
+        RoaringBitmap tmp;
+        index.term_set(s, node->children.get(0)->word, out);
+        for (size_t i = 1; i < node->children.size(); i++) {
+            index.term_set(s, node->children.get(i)->word, term);
+            RoaringBitmap::and_(out, term, tmp);
+            out.swap(tmp);
+        }
+        for (size_t i = 0; i < node->excluded.size(); i++) {
+            index.term_set(s, node->excluded.get(i)->word, term);
+            RoaringBitmap::andnot(out, term, tmp);
+            out.swap(tmp);
+        }
+    }
+
+    // AND/OR над одними терминами считается целиком ядрами set_ops.h
+    // по сегментам, прямо на отображённых списках. Если у операнда есть
+    // карта в bitmaps.bin, сегмент считается на множествах roaring.h.
+    DocIterator* build_term_set(const QueryNode* node) {
+        SimpleVector<int> result;
+        SimpleVector<PostingList> lists;
+        SimpleVector<PostingList> minus;
+        RoaringBitmap set;
+
+        for (size_t s = 0; s < index.segment_count(); s++) {
+            const int* docs = nullptr;
+            size_t n = 0;
+            int from, to;
+            if (!segment_range(s, from, to)) continue;
+            const DeletionBitmap& deleted = index.segment_deleted(s);
+            bool check = deleted.deleted_count() > 0;
+
+            if (segment_dense(s, node)) {
+                segment_set(s, node, set);
+                set.append_to(result, index.segment_base(s), check ? &deleted : nullptr, from, to);
+                continue;
+            }
+
+            if (node->type == NODE_OR) {
+                segment_lists(s, node->children, false, from, to, lists);
+                SimpleVector<const int*> heads;
+                SimpleVector<size_t> sizes;
+                for (size_t i = 0; i < lists.size(); i++) {
+                    heads.push(lists.get(i).docs);
+                    sizes.push(lists.get(i).count);
+                }
+                if (lists.size() == 0) continue;
+                unite_many(&heads.get(0), &sizes.get(0), lists.size(), buffer_a);
+                docs = buffer_a.size() > 0 ? &buffer_a.get(0) : nullptr;
+                n = buffer_a.size();
+            } else {
+                if (!segment_lists(s, node->children, true, from, to, lists)) continue;
+                segment_lists(s, node->excluded, false, from, to, minus);
+                docs = lists.get(0).docs;
+                n = lists.get(0).count;
+                if (buffer_a.size() < n) buffer_a.resize(n);
+                if (buffer_b.size() < n) buffer_b.resize(n);
+                int* out = &buffer_a.get(0);
+                for (size_t i = 1; i < lists.size() && n > 0; i++) {
+                    n = intersect_adaptive(docs, n, lists.get(i).docs, lists.get(i).count, out);
+                    docs = out;
+                    out = out == &buffer_a.get(0) ? &buffer_b.get(0) : &buffer_a.get(0);
+                }
+                for (size_t i = 0; i < minus.size() && n > 0; i++) {
+                    n = difference_adaptive(docs, n, minus.get(i).docs, minus.get(i).count, out);
+                    docs = out;
+                    out = out == &buffer_a.get(0) ? &buffer_b.get(0) : &buffer_a.get(0);
+                }
+            }
+
+            int base = index.segment_base(s);
+            result.reserve(result.size() + n);
+            for (size_t i = 0; i < n; i++) {
+                if (!check || !deleted.is_deleted(docs[i])) result.push(base + docs[i]);
+            }
+        }
+        return remember(node, result);
+    }
+
+    // Отрицание объединения терминов: дополнение множества в каждом
+    // сегменте считается по словам карты, а не перебором документов.
+    DocIterator* build_complement(const QueryNode* node, const SimpleVector<QueryNode*>& terms) {
+        SimpleVector<int> result;
+        RoaringBitmap set;
+        RoaringBitmap rest;
+        for (size_t s = 0; s < index.segment_count(); s++) {
+            int from, to;
+            if (!segment_range(s, from, to)) continue;
+            segment_union(s, terms, set);
+            set.complement(rest);
+            const DeletionBitmap& deleted = index.segment_deleted(s);
+            rest.append_to(result, index.segment_base(s), deleted.deleted_count() > 0 ? &deleted : nullptr, from, to);
+        }
+        return remember(node, result);
+    }
+
+    // Шаблон или слово~k раскрывается по словарю каждого сегмента, списки
+    // подходящих терминов объединяет unite_many: при большом покрытии -
+    // битовой картой, при многих редких списках - слиянием через кучу.
+    DocIterator* build_expansion(const QueryNode* node) {
+        SimpleVector<int> result;
+        SimpleVector<size_t> ids;
+        SimpleVector<const int*> heads;
+        SimpleVector<size_t> sizes;
+        for (size_t s = 0; s < index.segment_count(); s++) {
+            int from, to;
+            if (!segment_range(s, from, to)) continue;
+            if (node->type == NODE_FUZZY) index.expand_fuzzy(s, node->word, node->distance, ids);
+            else index.expand(s, node->word, ids);
+            heads.clear();
+            sizes.clear();
+            for (size_t i = 0; i < ids.size(); i++) {
+                PostingList list;
+                if (!index.postings_at(s, ids.get(i), list)) continue;
+                clip(list, from, to);
+                if (list.count == 0) continue;
+                heads.push(list.docs);
+                sizes.push(list.count);
+            }
+            if (heads.size() == 0) continue;
+            unite_many(&heads.get(0), &sizes.get(0), heads.size(), buffer_a);
+
+            const DeletionBitmap& deleted = index.segment_deleted(s);
+            bool check = deleted.deleted_count() > 0;
+            int base = index.segment_base(s);
+            result.reserve(result.size() + buffer_a.size());
+            for (size_t i = 0; i < buffer_a.size(); i++) {
+                int doc = buffer_a.get(i);
+                if (!check || !deleted.is_deleted(doc)) result.push(base + doc);
+            }
+        }
+        return remember(node, result);
+    }
+
+    // Под AND объединение остаётся ленивым: пересечение с редким
+    // операндом прочитает из него лишь несколько документов.
+    DocIterator* build_node(const QueryNode* node, bool under_and) {
+        if (node->type == NODE_TERM) {
+            return new TermIterator(index, node->word);
+        }
+
+        if (node->type == NODE_PATTERN || node->type == NODE_FUZZY) return build_expansion(node);
+
+        if (node->type == NODE_PHRASE || node->type == NODE_NEAR) {
+            SimpleVector<const char*> words;
+            for (size_t i = 0; i < node->children.size(); i++) words.push(node->children.get(i)->word);
+            return new PositionalIterator(index, words, node->type == NODE_PHRASE ? -1 : node->distance);
+        }
+
+        if (node->type == NODE_NOT) {
+            const QueryNode* inner = node->children.get(0);
+            if (inner->type == NODE_TERM) {
+                SimpleVector<QueryNode*> terms;
+                terms.push(const_cast<QueryNode*>(inner));
+                return build_complement(node, terms);
+            }
+            if (inner->type == NODE_OR && terms_only(inner->children)) return build_complement(node, inner->children);
+            return new NotIterator(build(inner, false), index, range_lo);
+        }
+
+        if (terms_only(node->children) && terms_only(node->excluded)) {
+            // !a && !b == !(a || b)
+            if (node->children.size() == 0) return build_complement(node, node->excluded);
+            if (node->type == NODE_OR && !under_and) return build_term_set(node);
+            if (node->type == NODE_AND && node->children.size() > 0 &&
+                node->children.size() + node->excluded.size() > 1) {
+                return build_term_set(node);
+            }
+        }
+
+        bool is_and = node->type == NODE_AND;
+        SimpleVector<DocIterator*> children;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            children.push(build(node->children.get(i), is_and));
+        }
+
+        if (!is_and) {
+            return new OrIterator(children);
+        }
+
+        SimpleVector<DocIterator*> excluded;
+        for (size_t i = 0; i < node->excluded.size(); i++) {
+            excluded.push(build(node->excluded.get(i), false));
+        }
+        if (children.size() == 0) {
+            // !a && !b == !(a || b)
+            DocIterator* any = excluded.size() == 1 ? excluded.get(0) : new OrIterator(excluded);
+            return new NotIterator(any, index, range_lo);
+        }
+        return new AndIterator(children, excluded);
+    }
+
+    // Общие поддеревья вычисляются один раз и дальше читаются из списка.
+    // Подвыражение, уже посчитанное в прежних запросах, берётся из кэша.
+    DocIterator* build(const QueryNode* node, bool under_and) {
+        if (cache && node->type != NODE_TERM) {
+            SimpleVector<int> cached;
+            if (cache->get(node->key, cached)) return new ListIterator(cached);
+        }
+        if (!node->shared) return build_node(node, under_and);
+
+        int slot;
+        if (!memo.find(node->key, slot)) {
+            SimpleVector<int>* result = new SimpleVector<int>();
+            DocIterator* it = build_node(node, false);
+            drain(it, *result);
+            delete it;
+            if (cache) cache->put(node->key, result->size() > 0 ? &result->get(0) : nullptr, result->size());
+            slot = static_cast<int>(memo_results.size());
+            memo.add(node->key, slot);
+            memo_results.push(result);
+        }
+        const SimpleVector<int>& list = *memo_results.get(slot);
+        return new ListIterator(list.size() > 0 ? &list.get(0) : nullptr, list.size());
+    }
+
+public:
+    // Считаются только документы из [lo, hi): так запрос делится между
+    // потоками. Кэш хранит результаты по всему индексу, поэтому при
+    // неполном диапазоне его не передают.
+    QueryExecutor(const SearchIndex& idx, QueryCache* c = nullptr, int lo = 0, int hi = NO_DOC)
+        : index(idx), cache(c), range_lo(lo), range_hi(hi), memo(64) {}
+
+    ~QueryExecutor() {
+        for (size_t i = 0; i < memo_results.size(); i++) delete memo_results.get(i);
+    }
+
+    SimpleVector<int> execute(const QueryNode* node) {
+        SimpleVector<int> result;
+        if (!node) return result;
+        if (node->type == NODE_TERM || !cache) {
+            DocIterator* root = build(node, false);
+            drain(root, result);
+            delete root;
+            return result;
+        }
+
+        // Повторный запрос отдаётся из кэша целиком, без итераторов.
+        if (cache->get(node->key, result)) return result;
+        DocIterator* root = build_node(node, false);
+        drain(root, result);
+        delete root;
+        cache->put(node->key, result.size() > 0 ? &result.get(0) : nullptr, result.size());
         return result;
     }
-    
-    return SimpleVector<int>();
+};
+
+// Тяжёлый запрос (читает больше PARALLEL_MIN_WORK номеров) делится на
+// диапазоны номеров документов по числу потоков. Каждый диапазон
+// считается тем же планом: итераторы галопом переходят к его началу,
+// ядра set_ops.h берут из списков только его часть. Результаты
+// диапазонов склеиваются по порядку.
+static const long long PARALLEL_MIN_WORK = 1 << 18;
+static const int PARALLEL_MIN_RANGE = 4096;
+
+static long long plan_work(const SearchIndex& idx, const QueryNode* node) {
+    if (node->type == NODE_TERM || node->type == NODE_PATTERN || node->type == NODE_FUZZY) return node->cost;
+    long long work = 0;
+    if (node->type == NODE_NOT || (node->type == NODE_AND && node->children.size() == 0)) {
+        work += idx.doc_total();
+    }
+    for (size_t i = 0; i < node->children.size(); i++) work += plan_work(idx, node->children.get(i));
+    for (size_t i = 0; i < node->excluded.size(); i++) work += plan_work(idx, node->excluded.get(i));
+    return work;
+}
+
+static SimpleVector<int> execute_query(const SearchIndex& idx, const QueryNode* plan, QueryCache* cache,
+                                       int thread_count) {
+    SimpleVector<int> result;
+    if (!plan) return result;
+    int total = idx.doc_total();
+    int parts = thread_count;
+    if (parts > total / PARALLEL_MIN_RANGE) parts = total / PARALLEL_MIN_RANGE;
+    if (parts > 1 && plan_work(idx, plan) < PARALLEL_MIN_WORK) parts = 1;
+    if (parts <= 1) {
+        QueryExecutor executor(idx, cache);
+        return executor.execute(plan);
+    }
+
+    bool cached = cache && plan->type != NODE_TERM;
+    if (cached && cache->get(plan->key, result)) return result;
+
+    SimpleVector<int>* pieces = new SimpleVector<int>[parts];
+    auto run = [&idx, plan, pieces, total, parts](int p) {
+        int lo = static_cast<int>(static_cast<long long>(total) * p / parts);
+        int hi = p + 1 == parts ? NO_DOC : static_cast<int>(static_cast<long long>(total) * (p + 1) / parts);
+        QueryExecutor executor(idx, nullptr, lo, hi);
+        SimpleVector<int> docs = executor.execute(plan);
+        pieces[p].swap(docs);
+    };
+    SimpleVector<std::thread*> pool;
+    for (int p = 1; p < parts; p++) {
+        pool.push(new std::thread(run, p));
+    }
+    run(0);
+    for (size_t t = 0; t < pool.size(); t++) {
+        pool.get(t)->join();
+        delete pool.get(t);
+    }
+
+    size_t count = 0;
+    for (int p = 0; p < parts; p++) count += pieces[p].size();
+    result.resize(count);
+    size_t at = 0;
+    for (int p = 0; p < parts; p++) {
+        if (pieces[p].size() > 0) memcpy(&result.get(at), &pieces[p].get(0), pieces[p].size() * sizeof(int));
+        at += pieces[p].size();
+    }
+    delete[] pieces;
+    if (cached) cache->put(plan->key, result.size() > 0 ? &result.get(0) : nullptr, result.size());
+    return result;
+}
+
+// Ранжирование BM25: k лучших документов запроса. Оценку дают термины
+// запроса вне отрицаний, idf считается по всем сегментам.
+//
+// Запрос из одного слова или из слов через || обходится Block-Max WAND:
+// курсоры терминов идут по спискам сегмента, документ считается целиком,
+// только если сумма верхних границ его терминов больше порога - худшей
+// оценки в текущей десятке. Сначала порог сравнивается с границами
+// терминов целиком (pivot), затем с границами их текущих блоков
+// scores.bin; если блоки не дотягивают, курсоры перескакивают за конец
+// ближайшего блока. Остальные запросы сначала вычисляются как булевы,
+// и оцениваются только найденные документы.
+struct ScoredDoc {
+    int doc;
+    double score;
+};
+
+// Хуже - меньше оценка, при равенстве - больший номер.
+inline bool scored_worse(const ScoredDoc& a, const ScoredDoc& b) {
+    return a.score != b.score ? a.score < b.score : a.doc > b.doc;
+}
+
+class Ranker {
+private:
+    struct TermCursor {
+        PostingList list;
+        int index;
+        double weight;
+        double max_score;
+        const BlockBound* blocks;
+        size_t block_count;
+
+        int doc() const { return index < list.count ? list.docs[index] : NO_DOC; }
+        int tf() const { return list.pos_offsets[index + 1] - list.pos_offsets[index]; }
+        void seek(int target) { index = static_cast<int>(gallop(list.docs, index, list.count, target)); }
+    };
+
+    const SearchIndex& index;
+    size_t k;
+    double avg_length;
+    SimpleVector<ScoredDoc> heap;
+    long long scored;
+    long long posting_total;
+
+    double threshold() const { return heap.size() < k ? -1.0 : heap.get(0).score; }
+
+    // Куча держит k лучших, на вершине худший из них.
+    void sift_down(const ScoredDoc& item) {
+        size_t i = 0;
+        size_t n = heap.size();
+        while (true) {
+            size_t child = 2 * i + 1;
+            if (child >= n) break;
+            if (child + 1 < n && scored_worse(heap.get(child + 1), heap.get(child))) child++;
+            if (!scored_worse(heap.get(child), item)) break;
+            heap.get(i) = heap.get(child);
+            i = child;
+        }
+        heap.get(i) = item;
+    }
+
+    void offer(int doc, double score) {
+        ScoredDoc item;
+        item.doc = doc;
+        item.score = score;
+        if (heap.size() == k) {
+            if (scored_worse(heap.get(0), item)) sift_down(item);
+            return;
+        }
+        size_t i = heap.size();
+        heap.push(item);
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (!scored_worse(item, heap.get(parent))) break;
+            heap.get(i) = heap.get(parent);
+            i = parent;
+        }
+        heap.get(i) = item;
+    }
+
+    double bound(const TermCursor& c, const BlockBound& b) const {
+        return c.weight * bm25_tf(b.max_tf, b.min_length, avg_length);
+    }
+
+    // Граница текущего блока курсора и последний документ блока.
+    double block_bound(const TermCursor& c, int& last) const {
+        if (!c.blocks) {
+            last = c.list.docs[c.list.count - 1];
+            return c.max_score;
+        }
+        size_t b = static_cast<size_t>(c.index) / SCORE_BLOCK;
+        size_t end = (b + 1) * SCORE_BLOCK;
+        last = c.list.docs[end < static_cast<size_t>(c.list.count) ? end - 1 : c.list.count - 1];
+        return bound(c, c.blocks[b]);
+    }
+
+    double length_of(const ScoreFile& scores, int doc) const {
+        return scores.is_open() ? scores.doc_length(doc) : avg_length;
+    }
+
+    // Курсоры терминов в сегменте s; термины без списка пропускаются.
+    void open_cursors(size_t s, const SimpleVector<QueryNode*>& terms, SimpleVector<TermCursor>& cursors) {
+        cursors.clear();
+        const ScoreFile& scores = index.segment_scores(s);
+        for (size_t i = 0; i < terms.size(); i++) {
+            TermCursor c;
+            size_t id;
+            if (!index.find_term(s, terms.get(i)->word, id) || !index.postings_at(s, id, c.list)) continue;
+            if (c.list.count == 0) continue;
+            posting_total += c.list.count;
+            c.index = 0;
+            // df из словаря считает и удалённые документы, поэтому N тоже с ними.
+            c.weight = bm25_idf(index.term_cost(terms.get(i)->word), index.doc_total());
+            c.blocks = nullptr;
+            c.block_count = 0;
+            // Без scores.bin длина неизвестна: предел вклада при tf -> бесконечность.
+            c.max_score = c.weight * (BM25_K1 + 1.0);
+            if (scores.is_open()) {
+                c.blocks = scores.term_blocks(id, c.block_count);
+                if (c.block_count * SCORE_BLOCK < static_cast<size_t>(c.list.count)) {
+                    c.blocks = nullptr;
+                } else {
+                    c.max_score = 0;
+                    for (size_t b = 0; b < c.block_count; b++) {
+                        double v = bound(c, c.blocks[b]);
+                        if (v > c.max_score) c.max_score = v;
+                    }
+                }
+            }
+            cursors.push(c);
+        }
+    }
+
+    static void sort_cursors(SimpleVector<TermCursor>& cursors) {
+        for (size_t i = 1; i < cursors.size(); i++) {
+            TermCursor c = cursors.get(i);
+            size_t j = i;
+            while (j > 0 && cursors.get(j - 1).doc() > c.doc()) {
+                cursors.get(j) = cursors.get(j - 1);
+                j--;
+            }
+            cursors.get(j) = c;
+        }
+    }
+
+    void rank_segment(size_t s, const SimpleVector<QueryNode*>& terms) {
+        SimpleVector<TermCursor> cursors;
+        open_cursors(s, terms, cursors);
+        const ScoreFile& scores = index.segment_scores(s);
+        const DeletionBitmap& deleted = index.segment_deleted(s);
+        int base = index.segment_base(s);
+        size_t n = cursors.size();
+
+        while (true) {
+            sort_cursors(cursors);
+            double theta = threshold();
+            double sum = 0;
+            size_t pivot = n;
+            for (size_t i = 0; i < n && cursors.get(i).doc() != NO_DOC; i++) {
+                sum += cursors.get(i).max_score;
+                if (sum > theta) {
+                    pivot = i;
+                    break;
+                }
+            }
+            if (pivot == n) break;
+            int d = cursors.get(pivot).doc();
+
+            // Документы до d есть только в списках перед pivot, а их
+            // границы вместе не выше порога.
+            for (size_t i = 0; i < pivot; i++) cursors.get(i).seek(d);
+
+            double block_sum = 0;
+            int next = NO_DOC;
+            for (size_t i = 0; i < n; i++) {
+                const TermCursor& c = cursors.get(i);
+                if (c.doc() == d) {
+                    int last;
+                    block_sum += block_bound(c, last);
+                    if (last < next - 1) next = last + 1;
+                } else if (c.doc() < next) {
+                    next = c.doc();
+                }
+            }
+
+            if (block_sum > theta) {
+                double score = 0;
+                double length = length_of(scores, d);
+                for (size_t i = 0; i < n; i++) {
+                    TermCursor& c = cursors.get(i);
+                    if (c.doc() != d) continue;
+                    score += c.weight * bm25_tf(c.tf(), length, avg_length);
+                    c.index++;
+                }
+                if (!deleted.is_deleted(d)) {
+                    scored++;
+                    offer(base + d, score);
+                }
+                continue;
+            }
+
+            // До next документы встречаются только в текущих блоках
+            // терминов с d, и вместе эти блоки не дотягивают до порога.
+            if (next <= d) next = d + 1;
+            for (size_t i = 0; i < n; i++) {
+                TermCursor& c = cursors.get(i);
+                if (c.doc() == d) c.seek(next);
+            }
+        }
+    }
+
+    // Оценка готовых документов (номера по возрастанию).
+    void rank_docs(const SimpleVector<int>& docs, const SimpleVector<QueryNode*>& terms) {
+        size_t at = 0;
+        SimpleVector<TermCursor> cursors;
+        for (size_t s = 0; s < index.segment_count() && at < docs.size(); s++) {
+            int base = index.segment_base(s);
+            int end = base + index.segment_size(s);
+            if (docs.get(at) >= end) continue;
+            open_cursors(s, terms, cursors);
+            const ScoreFile& scores = index.segment_scores(s);
+            for (; at < docs.size() && docs.get(at) < end; at++) {
+                int d = docs.get(at) - base;
+                double length = length_of(scores, d);
+                double score = 0;
+                for (size_t i = 0; i < cursors.size(); i++) {
+                    TermCursor& c = cursors.get(i);
+                    c.seek(d);
+                    if (c.doc() == d) score += c.weight * bm25_tf(c.tf(), length, avg_length);
+                }
+                scored++;
+                offer(docs.get(at), score);
+            }
+        }
+    }
+
+    // Термины вне отрицаний, без повторов.
+    static void collect_terms(const QueryNode* node, TermDict& seen, SimpleVector<QueryNode*>& out) {
+        if (node->type == NODE_NOT) return;
+        if (node->type == NODE_TERM) {
+            int slot;
+            if (seen.find(node->word, slot)) return;
+            seen.add(node->word, static_cast<int>(out.size()));
+            out.push(const_cast<QueryNode*>(node));
+            return;
+        }
+        for (size_t i = 0; i < node->children.size(); i++) collect_terms(node->children.get(i), seen, out);
+    }
+
+    static bool is_disjunction(const QueryNode* node) {
+        if (node->type == NODE_TERM) return true;
+        if (node->type != NODE_OR) return false;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            if (node->children.get(i)->type != NODE_TERM) return false;
+        }
+        return true;
+    }
+
+public:
+    Ranker(const SearchIndex& idx, size_t top_k)
+        : index(idx), k(top_k), avg_length(idx.average_length()), scored(0), posting_total(0) {}
+
+    // k лучших документов плана по убыванию оценки.
+    void rank(const QueryNode* plan, QueryCache* cache, int thread_count, SimpleVector<ScoredDoc>& out) {
+        out.clear();
+        heap.clear();
+        scored = 0;
+        posting_total = 0;
+        if (!plan || k == 0) return;
+        TermDict seen(16);
+        SimpleVector<QueryNode*> terms;
+        collect_terms(plan, seen, terms);
+        if (is_disjunction(plan)) {
+            for (size_t s = 0; s < index.segment_count(); s++) rank_segment(s, terms);
+        } else {
+            SimpleVector<int> docs = execute_query(index, plan, cache, thread_count);
+            if (docs.size() > 0) rank_docs(docs, terms);
+        }
+
+        out.resize(heap.size());
+        for (size_t i = heap.size(); i-- > 0;) {
+            out.get(i) = heap.get(0);
+            ScoredDoc last = heap.get(heap.size() - 1);
+            heap.pop();
+            if (heap.size() > 0) sift_down(last);
+        }
+    }
+
+    // Сколько документов оценено целиком и сколько всего в списках терминов.
+    long long scored_count() const { return scored; }
+    long long posting_count() const { return posting_total; }
+};
+
+// "Возможно, имелось в виду" для слов запроса, которых нет в индексе.
+static void print_suggestions(const SearchIndex& idx, const QueryNode* node) {
+    if (!node) return;
+    if (node->type == NODE_TERM) {
+        char fix[LEXICON_MAX_TERM];
+        if (idx.term_cost(node->word) == 0 && idx.suggest(node->word, fix, sizeof(fix))) {
+            std::cout << "Возможно, имелось в виду: " << fix << " (вместо " << node->word << ")\n";
+        }
+        return;
+    }
+    for (size_t i = 0; i < node->children.size(); i++) print_suggestions(idx, node->children.get(i));
+}
+
+static void print_completions(const SearchIndex& idx, const char* prefix) {
+    char word[256];
+    int i = 0;
+    while (*prefix && isspace(*prefix)) prefix++;
+    while (prefix[i] && !isspace(prefix[i]) && i < 255) {
+        word[i] = tolower(prefix[i]);
+        i++;
+    }
+    word[i] = '\0';
+
+    SimpleVector<Completion> completions;
+    idx.complete(word, COMPLETION_TOP_K, completions);
+    std::cout << "\nДополнения для \"" << word << "\": " << completions.size() << "\n";
+    for (size_t j = 0; j < completions.size(); j++) {
+        std::cout << "  " << completions.get(j).term << "\t" << completions.get(j).count << "\n";
+    }
+}
+
+static void print_ranked(const SearchIndex& idx, const QueryNode* plan, QueryCache* cache, int thread_count,
+                         int k) {
+    Ranker ranker(idx, static_cast<size_t>(k));
+    SimpleVector<ScoredDoc> top;
+    ranker.rank(plan, cache, thread_count, top);
+    std::cout << "\nЛучшие документы по BM25: " << top.size() << "\n";
+    for (size_t i = 0; i < top.size(); i++) {
+        const char* name = idx.doc_name(top.get(i).doc);
+        char score[32];
+        snprintf(score, sizeof(score), "%.4f", top.get(i).score);
+        std::cout << "  " << i + 1 << ". " << (name ? name : "?") << "\t" << score << "\n";
+    }
+    std::cerr << "Оценено документов: " << ranker.scored_count() << " из " << ranker.posting_count()
+              << " в списках терминов" << std::endl;
+}
+
+static void print_cache_stats(const QueryCache& cache) {
+    if (!cache.enabled()) return;
+    std::cerr << "Кэш: обращений " << cache.lookup_count() << ", попаданий " << cache.hit_count()
+              << " (" << static_cast<int>(cache.hit_rate() * 100 + 0.5) << "%), записей " << cache.size()
+              << ", " << cache.memory_used() / 1024 << " КБ" << std::endl;
+}
+
+// Пакетный режим: запросы из файла считаются пулом потоков над общим
+// индексом (он только читается), результаты пишутся в порядке запросов.
+// Поток не уходит дальше чем на BATCH_WINDOW запросов вперёд от
+// записанного, так что в памяти держится ограниченное число результатов.
+static const size_t BATCH_WINDOW = 256;
+
+struct BatchSlot {
+    SimpleVector<int>* result;
+    double latency_ms;
+    bool done;
+};
+
+static void write_batch_result(FILE* out, const SearchIndex& idx, const char* query, const SimpleVector<int>& docs) {
+    fprintf(out, "%s\t%zu", query, docs.size());
+    for (size_t i = 0; i < docs.size(); i++) {
+        const char* name = idx.doc_name(docs.get(i));
+        fprintf(out, "\t%s", name ? name : "?");
+    }
+    fputc('\n', out);
+}
+
+static int run_batch(const SearchIndex& idx, QueryCache* cache, const char* queries_path, const char* out_path,
+                     int thread_count, int rank_k) {
+    FILE* in = fopen(queries_path, "r");
+    if (!in) {
+        std::cerr << "Не удалось открыть " << queries_path << std::endl;
+        return 1;
+    }
+    SimpleVector<char*> queries;
+    char line[4096];
+    while (fgets(line, sizeof(line), in)) {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        if (len == 0) continue;
+        char* copy = static_cast<char*>(malloc(len + 1));
+        memcpy(copy, line, len + 1);
+        queries.push(copy);
+    }
+    fclose(in);
+
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        std::cerr << "Не удалось создать " << out_path << std::endl;
+        for (size_t i = 0; i < queries.size(); i++) free(queries.get(i));
+        return 1;
+    }
+
+    size_t n = queries.size();
+    BatchSlot* slots = static_cast<BatchSlot*>(calloc(n > 0 ? n : 1, sizeof(BatchSlot)));
+    std::atomic<size_t> next(0);
+    size_t written = 0;
+    std::mutex lock;
+    std::condition_variable slot_done;
+    std::condition_variable slot_free;
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= n) return;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                slot_free.wait(guard, [&]() { return i < written + BATCH_WINDOW; });
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            QueryParser parser(queries.get(i), rank_k > 0);
+            QueryPlanner planner(idx);
+            QueryNode* plan = planner.plan(parser.parse());
+            SimpleVector<int>* result = new SimpleVector<int>();
+            if (rank_k > 0) {
+                Ranker ranker(idx, static_cast<size_t>(rank_k));
+                SimpleVector<ScoredDoc> top;
+                ranker.rank(plan, cache, 1, top);
+                for (size_t j = 0; j < top.size(); j++) result->push(top.get(j).doc);
+            } else {
+                QueryExecutor executor(idx, cache);
+                SimpleVector<int> docs = executor.execute(plan);
+                result->swap(docs);
+            }
+            delete plan;
+            auto finish = std::chrono::steady_clock::now();
+
+            std::lock_guard<std::mutex> guard(lock);
+            slots[i].result = result;
+            slots[i].latency_ms = std::chrono::duration<double, std::milli>(finish - start).count();
+            slots[i].done = true;
+            slot_done.notify_all();
+        }
+    };
+
+    auto started = std::chrono::steady_clock::now();
+    SimpleVector<std::thread*> pool;
+    for (int t = 0; t < thread_count; t++) {
+        pool.push(new std::thread(worker));
+    }
+
+    SimpleVector<double> latencies;
+    latencies.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        SimpleVector<int>* result;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            slot_done.wait(guard, [&]() { return slots[i].done; });
+            result = slots[i].result;
+            slots[i].result = nullptr;
+            latencies.push(slots[i].latency_ms);
+            written = i + 1;
+            slot_free.notify_all();
+        }
+        write_batch_result(out, idx, queries.get(i), *result);
+        delete result;
+    }
+
+    for (size_t t = 0; t < pool.size(); t++) {
+        pool.get(t)->join();
+        delete pool.get(t);
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    if (out != stdout) fclose(out);
+    else fflush(out);
+
+    double sum = 0;
+    for (size_t i = 0; i < latencies.size(); i++) sum += latencies.get(i);
+    latencies.sort_quick();
+    std::cerr << "Запросов: " << n << ", потоков: " << thread_count << ", время: " << total_ms / 1000 << " с, "
+              << (total_ms > 0 ? n * 1000.0 / total_ms : 0) << " запросов/с" << std::endl;
+    if (n > 0) {
+        std::cerr << "Задержка, мс: средняя " << sum / n
+                  << ", p50 " << latencies.get(n / 2)
+                  << ", p95 " << latencies.get(n * 95 / 100)
+                  << ", p99 " << latencies.get(n * 99 / 100)
+                  << ", макс " << latencies.get(n - 1) << std::endl;
+    }
+
+    free(slots);
+    for (size_t i = 0; i < queries.size(); i++) free(queries.get(i));
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    const char* index_dir = nullptr;
+    const char* batch_path = nullptr;
+    const char* out_path = nullptr;
+    bool suggest = false;
+    int rank_k = 0;
+    long long cache_mb = 64;
+    int thread_count = static_cast<int>(std::thread::hardware_concurrency());
+    if (thread_count < 1) thread_count = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cache_mb = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_path = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (strcmp(argv[i], "--suggest") == 0) {
+            suggest = true;
+        } else if (strcmp(argv[i], "--rank") == 0 && i + 1 < argc) {
+            rank_k = atoi(argv[++i]);
+        } else {
+            index_dir = argv[i];
+        }
+    }
+    
+    if (!index_dir || cache_mb < 0 || thread_count < 1 || rank_k < 0) {
         std::cout << "=== Булев поиск (ЛР7) ===\n";
-        std::cout << "Использование: " << argv[0] << " <папка_с_индексом>\n";
+        std::cout << "Использование: " << argv[0] << " [--cache-mb N] <папка_с_индексом>\n";
         std::cout << "Пример: " << argv[0] << " index\n";
         std::cout << "Запросы читаются из stdin\n";
         std::cout << "Пример запроса: революция AND (франция OR париж) NOT война\n";
+        std::cout << "Фраза и близость: \"эйфелева башня\" && париж NEAR/5 выставка\n";
+        std::cout << "Шаблоны: револю* || ст*ция || *град*\n";
+        std::cout << "Нечёткий поиск: рефолюция~1 || прэзидент~2 (до " << MAX_FUZZY_DISTANCE << " правок)\n";
+        std::cout << "Дополнение: ?рево - " << COMPLETION_TOP_K << " самых частых терминов с этим началом\n";
+        std::cout << "  --cache-mb N  память под кэш результатов, МБ (по умолчанию 64, 0 - без кэша)\n";
+        std::cout << "  --batch F     пакетный режим: запросы из файла F, по строке на запрос\n";
+        std::cout << "  --threads N   потоков (по умолчанию - по числу ядер): в пакетном режиме\n";
+        std::cout << "                на запросы, иначе на диапазоны документов тяжёлого запроса\n";
+        std::cout << "  --out F       результаты пакетного режима в файл F (иначе stdout):\n";
+        std::cout << "                запрос, число документов и их имена через табуляцию\n";
+        std::cout << "  --suggest     при пустом результате подсказывать похожие термины\n";
+        std::cout << "  --rank K      K лучших документов по BM25 вместо всего множества;\n";
+        std::cout << "                слова без операторов объединяются через ||\n";
         return 1;
     }
     
-    SearchIndex idx;
-    if (!idx.load(argv[1])) {
+    SearchIndex* idx = new SearchIndex();
+    uint64_t stamp = index_stamp(index_dir);
+    if (!idx->load(index_dir)) {
         std::cerr << "Не удалось загрузить индекс" << std::endl;
+        delete idx;
         return 1;
     }
+    QueryCache cache(static_cast<size_t>(cache_mb) * 1024 * 1024);
+    cache.validate(stamp);
+    
+    if (batch_path) {
+        int code = run_batch(*idx, cache.enabled() ? &cache : nullptr, batch_path, out_path, thread_count, rank_k);
+        print_cache_stats(cache);
+        delete idx;
+        return code;
+    }
     
     std::cerr << "\n=== Булев поиск готов ===\n";
     std::cerr << "Введите запрос (или Ctrl+Z для выхода):\n> ";
@@ -386,8 +2338,38 @@ int main(int argc, char* argv[]) {
         
         std::cerr << "Запрос: " << query << std::endl;
         
-        QueryParser parser(query);
-        SimpleVector<int> results = parser.parse(idx);
+        // Индекс изменился на диске (--add, --delete, --merge): загружаем
+        // заново, кэш сбрасывается вместе со старым отпечатком.
+        uint64_t current = index_stamp(index_dir);
+        if (current != stamp) {
+            SearchIndex* fresh = new SearchIndex();
+            if (fresh->load(index_dir)) {
+                delete idx;
+                idx = fresh;
+                stamp = current;
+                cache.validate(stamp);
+            } else {
+                std::cerr << "Не удалось перезагрузить индекс, используется прежний" << std::endl;
+                delete fresh;
+            }
+        }
+        
+        if (query[0] == '?') {
+            print_completions(*idx, query + 1);
+            std::cerr << "\n> ";
+            continue;
+        }
+        
+        QueryParser parser(query, rank_k > 0);
+        QueryPlanner planner(*idx);
+        QueryNode* plan = planner.plan(parser.parse());
+        if (rank_k > 0) {
+            print_ranked(*idx, plan, cache.enabled() ? &cache : nullptr, thread_count, rank_k);
+            delete plan;
+            std::cerr << "\n> ";
+            continue;
+        }
+        SimpleVector<int> results = execute_query(*idx, plan, cache.enabled() ? &cache : nullptr, thread_count);
         
         std::cout << "\nНайдено документов: " << results.size() << "\n";
         
@@ -395,15 +2377,19 @@ int main(int argc, char* argv[]) {
             std::cout << "Результаты:\n";
             for (size_t i = 0; i < results.size(); i++) {
                 int doc_id = results.get(i);
-                const char* name = idx.doc_name(doc_id);
+                const char* name = idx->doc_name(doc_id);
                 //std::cout << "  " << doc_id << "\t" << (name ? name : "?") << std::endl;
             }
         } else {
             std::cout << "По запросу ничего не найдено\n";
+            if (suggest) print_suggestions(*idx, plan);
         }
+        delete plan;
         
         std::cerr << "\n> ";
     }
     
+    print_cache_stats(cache);
+    delete idx;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,95 @@
+#ifndef BUFFERED_WRITER_H
+#define BUFFERED_WRITER_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Запись крупными блоками с учётом смещения без ftell.
+class BufferedWriter {
+private:
+    FILE* file;
+    char* buffer;
+    size_t capacity;
+    size_t used;
+    long long flushed;
+    bool failed;
+
+    BufferedWriter(const BufferedWriter&);
+    BufferedWriter& operator=(const BufferedWriter&);
+
+    void flush() {
+        if (used > 0 && file && fwrite(buffer, 1, used, file) != used) failed = true;
+        flushed += used;
+        used = 0;
+    }
+
+public:
+    BufferedWriter(size_t buffer_size = 4 << 20)
+        : file(nullptr), buffer(nullptr), capacity(buffer_size), used(0), flushed(0), failed(false) {}
+
+    ~BufferedWriter() {
+        close();
+        free(buffer);
+    }
+
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "wb");
+        if (!file) return false;
+        if (!buffer) buffer = static_cast<char*>(malloc(capacity));
+        used = 0;
+        flushed = 0;
+        failed = false;
+        return true;
+    }
+
+    void write(const void* data, size_t size) {
+        const char* src = static_cast<const char*>(data);
+        while (size > 0) {
+            if (used == capacity) flush();
+            size_t chunk = capacity - used < size ? capacity - used : size;
+            memcpy(buffer + used, src, chunk);
+            used += chunk;
+            src += chunk;
+            size -= chunk;
+        }
+    }
+
+    void write_int(int value) {
+        if (capacity - used < sizeof(int)) flush();
+        memcpy(buffer + used, &value, sizeof(int));
+        used += sizeof(int);
+    }
+
+    void put(char c) {
+        if (used == capacity) flush();
+        buffer[used++] = c;
+    }
+
+    void write_decimal(long long value) {
+        char digits[24];
+        int n = 0;
+        bool negative = value < 0;
+        unsigned long long v = negative ? 0ULL - static_cast<unsigned long long>(value)
+                                        : static_cast<unsigned long long>(value);
+        do {
+            digits[n++] = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v > 0);
+        if (negative) put('-');
+        while (n > 0) put(digits[--n]);
+    }
+
+    long long offset() const { return flushed + static_cast<long long>(used); }
+
+    bool close() {
+        if (!file) return !failed;
+        flush();
+        if (fclose(file) != 0) failed = true;
+        file = nullptr;
+        return !failed;
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef BUILD_PROFILE_H
+#define BUILD_PROFILE_H
+
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include "simple_vector.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#endif
+
+// Текущий и пиковый объём резидентной памяти процесса, байт.
+inline bool process_memory(size_t& current, size_t& peak) {
+    current = 0;
+    peak = 0;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return false;
+    current = counters.WorkingSetSize;
+    peak = counters.PeakWorkingSetSize;
+    return true;
+#else
+    FILE* file = fopen("/proc/self/status", "r");
+    if (!file) return false;
+    char line[256];
+    unsigned long long kb;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmRSS: %llu", &kb) == 1) current = static_cast<size_t>(kb) * 1024;
+        else if (sscanf(line, "VmHWM: %llu", &kb) == 1) peak = static_cast<size_t>(kb) * 1024;
+    }
+    fclose(file);
+    return current > 0;
+#endif
+}
+
+// Живые блоки памяти структуры: число, выделено байт и занято байт.
+struct AllocStats {
+    long long blocks;
+    long long bytes;
+    long long used;
+
+    AllocStats() : blocks(0), bytes(0), used(0) {}
+
+    void add(size_t allocated, size_t in_use) {
+        blocks++;
+        bytes += static_cast<long long>(allocated);
+        used += static_cast<long long>(in_use);
+    }
+
+    template<typename T>
+    void add_vector(const SimpleVector<T>& v) {
+        if (v.capacity() > 0) add(v.capacity() * sizeof(T), v.size() * sizeof(T));
+    }
+};
+
+// Время и память по этапам построения индекса, пишется в stats.json.
+class BuildProfile {
+private:
+    struct Phase {
+        const char* name;
+        double ms;
+        size_t rss;
+
+        Phase() : name(nullptr), ms(0), rss(0) {}
+        Phase(const char* n, double t, size_t r) : name(n), ms(t), rss(r) {}
+    };
+
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point mark;
+    SimpleVector<Phase> phases;
+
+    static void write_alloc(FILE* file, const char* name, const AllocStats& s, bool last) {
+        fprintf(file, "    \"%s\": {\"blocks\": %lld, \"bytes\": %lld, \"used_bytes\": %lld}%s\n",
+                name, s.blocks, s.bytes, s.used, last ? "" : ",");
+    }
+
+public:
+    long long documents;
+    long long occurrences;
+    long long terms;
+    AllocStats dictionary;
+    AllocStats postings;
+    AllocStats positions;
+    AllocStats doc_names;
+
+    BuildProfile() : documents(0), occurrences(0), terms(0) {
+        started = mark = std::chrono::steady_clock::now();
+    }
+
+    // Завершает этап, начатый предыдущим вызовом (или созданием профиля).
+    void phase(const char* name) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        size_t current, peak;
+        process_memory(current, peak);
+        phases.push(Phase(name, std::chrono::duration<double, std::milli>(now - mark).count(), current));
+        mark = now;
+    }
+
+    double total_ms() const {
+        return std::chrono::duration<double, std::milli>(mark - started).count();
+    }
+
+    double phase_ms(const char* name) const {
+        for (size_t i = 0; i < phases.size(); i++) {
+            if (strcmp(phases.get(i).name, name) == 0) return phases.get(i).ms;
+        }
+        return 0;
+    }
+
+    bool write(const char* path) const {
+        FILE* file = fopen(path, "w");
+        if (!file) return false;
+
+        size_t current, peak;
+        process_memory(current, peak);
+        double total = total_ms();
+        double parse = phase_ms("build_from_dir");
+
+        fprintf(file, "{\n");
+        fprintf(file, "  \"documents\": %lld,\n", documents);
+        fprintf(file, "  \"occurrences\": %lld,\n", occurrences);
+        fprintf(file, "  \"terms\": %lld,\n", terms);
+        fprintf(file, "  \"total_ms\": %.3f,\n", total);
+        fprintf(file, "  \"phases\": [\n");
+        for (size_t i = 0; i < phases.size(); i++) {
+            const Phase& p = phases.get(i);
+            fprintf(file, "    {\"name\": \"%s\", \"ms\": %.3f, \"rss_bytes\": %zu}%s\n",
+                    p.name, p.ms, p.rss, i + 1 < phases.size() ? "," : "");
+        }
+        fprintf(file, "  ],\n");
+        fprintf(file, "  \"throughput\": {\n");
+        fprintf(file, "    \"docs_per_sec\": %.1f,\n", parse > 0 ? documents * 1000.0 / parse : 0.0);
+        fprintf(file, "    \"occurrences_per_sec\": %.1f,\n", parse > 0 ? occurrences * 1000.0 / parse : 0.0);
+        fprintf(file, "    \"docs_per_sec_total\": %.1f,\n", total > 0 ? documents * 1000.0 / total : 0.0);
+        fprintf(file, "    \"occurrences_per_sec_total\": %.1f\n", total > 0 ? occurrences * 1000.0 / total : 0.0);
+        fprintf(file, "  },\n");
+        fprintf(file, "  \"memory\": {\"current_rss_bytes\": %zu, \"peak_rss_bytes\": %zu},\n", current, peak);
+        fprintf(file, "  \"allocations\": {\n");
+        write_alloc(file, "dictionary", dictionary, false);
+        write_alloc(file, "postings", postings, false);
+        write_alloc(file, "positions", positions, false);
+        write_alloc(file, "doc_names", doc_names, true);
+        fprintf(file, "  }\n");
+        fprintf(file, "}\n");
+
+        return fclose(file) == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include "simple_vector.h"
+#include "mapped_file.h"
+#include "lexicon.h"
+
+// Формат completions.bin - дерево максимумов над doc_count терминов в
+// порядке словаря:
+//   CompletionHeader
+//   uint32_t best[leaf_count]     best[v] - номер самого частого термина
+//                                 в поддереве v (best[0] не используется)
+// Листья неявные: лист leaf_count + i - термин i. Термины с общим
+// префиксом идут в словаре подряд, так что дополнения префикса - это
+// k самых частых терминов диапазона prefix_range. Они снимаются обходом
+// дерева по убыванию максимумов: O(k log n) без просмотра диапазона.
+
+static const char COMPLETION_MAGIC[4] = {'B', 'C', 'M', 'P'};
+static const uint32_t COMPLETION_VERSION = 1;
+static const uint32_t NO_TERM = 0xFFFFFFFFu;
+
+struct CompletionHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t term_count;
+    uint32_t leaf_count;
+};
+
+// Частота с номером: чаще - раньше, при равенстве - раньше по словарю.
+inline bool completion_before(int count_a, uint32_t id_a, int count_b, uint32_t id_b) {
+    return count_a != count_b ? count_a > count_b : id_a < id_b;
+}
+
+class CompletionWriter {
+private:
+    SimpleVector<int> doc_counts;
+
+public:
+    // Термины добавляются в порядке словаря.
+    void add(int doc_count) {
+        doc_counts.push(doc_count);
+    }
+
+    bool write(const char* path) const {
+        uint32_t n = static_cast<uint32_t>(doc_counts.size());
+        uint32_t leaves = 1;
+        while (leaves < n) leaves *= 2;
+
+        SimpleVector<uint32_t> best;
+        best.resize(2 * leaves);
+        for (uint32_t i = 0; i < leaves; i++) best.get(leaves + i) = i < n ? i : NO_TERM;
+        for (uint32_t v = leaves - 1; v > 0; v--) {
+            uint32_t a = best.get(2 * v);
+            uint32_t b = best.get(2 * v + 1);
+            if (a == NO_TERM || (b != NO_TERM && completion_before(doc_counts.get(b), b, doc_counts.get(a), a))) a = b;
+            best.get(v) = a;
+        }
+
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+        CompletionHeader header;
+        memcpy(header.magic, COMPLETION_MAGIC, sizeof(header.magic));
+        header.version = COMPLETION_VERSION;
+        header.term_count = n;
+        header.leaf_count = leaves;
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&best.get(0), sizeof(uint32_t), leaves, file) == leaves;
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+class CompletionFile {
+private:
+    struct Candidate {
+        int count;
+        uint32_t id;
+        uint32_t node;
+    };
+
+    MappedFile file;
+    const CompletionHeader* header;
+    const uint32_t* best;
+
+    uint32_t node_best(uint32_t v) const {
+        return v >= header->leaf_count ? v - header->leaf_count : best[v];
+    }
+
+    static void push(SimpleVector<Candidate>& heap, const Candidate& c) {
+        size_t i = heap.size();
+        heap.push(c);
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            const Candidate& p = heap.get(parent);
+            if (!completion_before(c.count, c.id, p.count, p.id)) break;
+            heap.get(i) = p;
+            i = parent;
+        }
+        heap.get(i) = c;
+    }
+
+    static Candidate pop(SimpleVector<Candidate>& heap) {
+        Candidate top = heap.get(0);
+        Candidate item = heap.get(heap.size() - 1);
+        heap.pop();
+        size_t n = heap.size();
+        size_t i = 0;
+        while (n > 0) {
+            size_t child = 2 * i + 1;
+            if (child >= n) break;
+            if (child + 1 < n && completion_before(heap.get(child + 1).count, heap.get(child + 1).id,
+                                                   heap.get(child).count, heap.get(child).id)) {
+                child++;
+            }
+            if (!completion_before(heap.get(child).count, heap.get(child).id, item.count, item.id)) break;
+            heap.get(i) = heap.get(child);
+            i = child;
+        }
+        if (n > 0) heap.get(i) = item;
+        return top;
+    }
+
+    void push_node(const Lexicon& lexicon, SimpleVector<Candidate>& heap, uint32_t v) const {
+        uint32_t id = node_best(v);
+        if (id == NO_TERM || id >= header->term_count) return;
+        Candidate c;
+        c.count = lexicon.doc_count(id);
+        c.id = id;
+        c.node = v;
+        push(heap, c);
+    }
+
+public:
+    CompletionFile() : header(nullptr), best(nullptr) {}
+
+    bool open(const char* path, uint32_t term_count) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(CompletionHeader)) return false;
+        const CompletionHeader* h = reinterpret_cast<const CompletionHeader*>(file.data());
+        if (memcmp(h->magic, COMPLETION_MAGIC, sizeof(h->magic)) != 0 || h->version != COMPLETION_VERSION ||
+            h->term_count != term_count || h->leaf_count < term_count) {
+            return false;
+        }
+        if (file.size() != sizeof(CompletionHeader) + static_cast<size_t>(h->leaf_count) * sizeof(uint32_t)) {
+            return false;
+        }
+        best = reinterpret_cast<const uint32_t*>(file.data() + sizeof(CompletionHeader));
+        header = h;
+        return true;
+    }
+
+    // До k самых частых терминов из [first, last), по убыванию doc_count.
+    // Без completions.bin диапазон просматривается целиком.
+    void top(const Lexicon& lexicon, size_t first, size_t last, size_t k, SimpleVector<uint32_t>& out) const {
+        out.clear();
+        if (first >= last || k == 0) return;
+        SimpleVector<Candidate> heap;
+        if (!header) {
+            for (size_t id = first; id < last; id++) {
+                Candidate c;
+                c.count = lexicon.doc_count(id);
+                c.id = static_cast<uint32_t>(id);
+                c.node = 0;
+                push(heap, c);
+            }
+            while (heap.size() > 0 && out.size() < k) out.push(pop(heap).id);
+            return;
+        }
+
+        // Диапазон листьев раскладывается на O(log n) целых поддеревьев.
+        uint32_t lo = static_cast<uint32_t>(first) + header->leaf_count;
+        uint32_t hi = static_cast<uint32_t>(last) + header->leaf_count;
+        while (lo < hi) {
+            if (lo & 1) push_node(lexicon, heap, lo++);
+            if (hi & 1) push_node(lexicon, heap, --hi);
+            lo >>= 1;
+            hi >>= 1;
+        }
+        // Максимум поддерева равен максимуму одного из детей: извлечённое
+        // поддерево заменяется детьми, пока на вершину не выйдет лист.
+        while (heap.size() > 0 && out.size() < k) {
+            Candidate c = pop(heap);
+            if (c.node >= header->leaf_count) {
+                out.push(c.id);
+                continue;
+            }
+            push_node(lexicon, heap, 2 * c.node);
+            push_node(lexicon, heap, 2 * c.node + 1);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef DOC_REORDER_H
+#define DOC_REORDER_H
+
+#include <cmath>
+#include "simple_vector.h"
+
+// Перенумерация документов рекурсивной бисекцией графа документ-термин
+// (Dhulipala et al., "Compressing Graphs and Indexes with Recursive Graph
+// Bisection", KDD 2016). Множество документов делится пополам, затем
+// документы обмениваются между половинами, пока это уменьшает оценку
+// длины d-промежутков sum_t d * log2(n / (d + 1)). Документы с общими
+// терминами оказываются рядом, промежутки в списках становятся короче.
+class GraphBisection {
+private:
+    static const int MIN_SIZE = 16;
+    static const int ITERATIONS = 20;
+
+    struct Gain {
+        double value;
+        int doc;
+
+        Gain() : value(0), doc(0) {}
+        Gain(double v, int d) : value(v), doc(d) {}
+
+        bool operator<(const Gain& other) const {
+            if (value != other.value) return value > other.value;
+            return doc < other.doc;
+        }
+    };
+
+    const int* offsets;
+    const int* terms;
+    SimpleVector<int> deg_left;
+    SimpleVector<int> deg_right;
+    SimpleVector<double> log_table;
+    int max_depth;
+
+    double cost(int n_log_index, int d) const {
+        return d * (log_table.get(n_log_index) - log_table.get(d + 1));
+    }
+
+    // Выигрыш от переноса документа с термином из части "from" в часть "to".
+    double move_gain(int d_from, int d_to, int n_from, int n_to) const {
+        double before = cost(n_from, d_from) + cost(n_to, d_to);
+        double after = cost(n_from, d_from - 1) + cost(n_to, d_to + 1);
+        return before - after;
+    }
+
+    void compute_gains(const int* docs, int from, int to, int n_from, int n_to,
+                       const SimpleVector<int>& deg_from, const SimpleVector<int>& deg_to,
+                       SimpleVector<Gain>& gains) const {
+        gains.clear();
+        for (int i = from; i < to; i++) {
+            int doc = docs[i];
+            double value = 0;
+            for (int k = offsets[doc]; k < offsets[doc + 1]; k++) {
+                int t = terms[k];
+                value += move_gain(deg_from.get(t), deg_to.get(t), n_from, n_to);
+            }
+            gains.push(Gain(value, doc));
+        }
+        gains.sort_quick();
+    }
+
+    void bisect(int* docs, int n, int depth) {
+        if (n <= MIN_SIZE || depth >= max_depth) return;
+
+        int n1 = n / 2;
+        int n2 = n - n1;
+        SimpleVector<Gain> left;
+        SimpleVector<Gain> right;
+
+        for (int iter = 0; iter < ITERATIONS; iter++) {
+            for (int i = 0; i < n; i++) {
+                for (int k = offsets[docs[i]]; k < offsets[docs[i] + 1]; k++) {
+                    deg_left.get(terms[k]) = 0;
+                    deg_right.get(terms[k]) = 0;
+                }
+            }
+            for (int i = 0; i < n; i++) {
+                SimpleVector<int>& deg = i < n1 ? deg_left : deg_right;
+                for (int k = offsets[docs[i]]; k < offsets[docs[i] + 1]; k++) {
+                    deg.get(terms[k])++;
+                }
+            }
+
+            compute_gains(docs, 0, n1, n1, n2, deg_left, deg_right, left);
+            compute_gains(docs, n1, n, n2, n1, deg_right, deg_left, right);
+
+            int swaps = 0;
+            while (swaps < n1 && left.get(swaps).value + right.get(swaps).value > 0) {
+                swaps++;
+            }
+            if (swaps == 0) break;
+
+            for (int i = 0; i < n1; i++) {
+                docs[i] = i < swaps ? right.get(i).doc : left.get(i).doc;
+            }
+            for (int i = 0; i < n2; i++) {
+                docs[n1 + i] = i < swaps ? left.get(i).doc : right.get(i).doc;
+            }
+        }
+
+        bisect(docs, n1, depth + 1);
+        bisect(docs + n1, n2, depth + 1);
+    }
+
+public:
+    // offsets/terms - списки терминов документов (CSR): термины документа d
+    // лежат в terms[offsets[d] .. offsets[d + 1]).
+    GraphBisection(const int* doc_offsets, const int* doc_terms, int term_count)
+        : offsets(doc_offsets), terms(doc_terms), max_depth(0) {
+        deg_left.reserve(term_count);
+        deg_right.reserve(term_count);
+        for (int i = 0; i < term_count; i++) {
+            deg_left.push(0);
+            deg_right.push(0);
+        }
+    }
+
+    // order[i] - старый номер документа, который получает новый номер i.
+    void run(int doc_count, SimpleVector<int>& order) {
+        log_table.clear();
+        log_table.push(0);
+        for (int i = 1; i <= doc_count + 2; i++) {
+            log_table.push(log2(static_cast<double>(i)));
+        }
+
+        max_depth = 0;
+        while ((MIN_SIZE << max_depth) < doc_count) max_depth++;
+
+        order.clear();
+        for (int i = 0; i < doc_count; i++) {
+            order.push(i);
+        }
+        if (doc_count > 0) {
+            bisect(&order.get(0), doc_count, 0);
+        }
+    }
+};
+
+#endif
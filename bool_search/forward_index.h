@@ -0,0 +1,173 @@
+#ifndef FORWARD_INDEX_H
+#define FORWARD_INDEX_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include "simple_vector.h"
+#include "mapped_file.h"
+#include "varint.h"
+
+// Формат forward.bin (прямой индекс, читается через mmap):
+//   ForwardHeader
+//   uint64_t row_offsets[doc_count + 1]   начало строки документа в rows
+//   uint32_t doc_lengths[doc_count]       число вхождений в документе
+//   uint32_t row_sizes[doc_count]         число различных терминов
+//   uint8_t  rows[rows_size]
+// Строка документа - пары (varint приращения номера термина, varint tf)
+// по возрастанию номера. Номер термина - его порядковый номер в lexicon.bin
+// того же сегмента.
+
+static const char FORWARD_MAGIC[4] = {'B', 'F', 'W', 'D'};
+static const uint32_t FORWARD_VERSION = 1;
+
+struct ForwardHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t reserved;
+    uint64_t rows_size;
+};
+
+class ForwardWriter {
+private:
+    SimpleVector<uint64_t> row_offsets;
+    SimpleVector<uint32_t> doc_lengths;
+    SimpleVector<uint32_t> row_sizes;
+    unsigned char* rows;
+    size_t rows_size;
+    size_t rows_capacity;
+
+public:
+    ForwardWriter() : rows(nullptr), rows_size(0), rows_capacity(0) {
+        row_offsets.push(0);
+    }
+
+    ~ForwardWriter() {
+        free(rows);
+    }
+
+    // term_ids по возрастанию.
+    void add_row(const uint32_t* term_ids, const uint32_t* tfs, size_t n) {
+        size_t need = rows_size + n * 10;
+        if (need > rows_capacity) {
+            size_t new_cap = rows_capacity ? rows_capacity * 2 : 65536;
+            while (new_cap < need) new_cap *= 2;
+            rows = static_cast<unsigned char*>(realloc(rows, new_cap));
+            rows_capacity = new_cap;
+        }
+
+        uint32_t prev = 0;
+        uint32_t length = 0;
+        for (size_t i = 0; i < n; i++) {
+            rows_size += write_varint(rows + rows_size, term_ids[i] - prev);
+            rows_size += write_varint(rows + rows_size, tfs[i]);
+            prev = term_ids[i];
+            length += tfs[i];
+        }
+        row_offsets.push(rows_size);
+        doc_lengths.push(length);
+        row_sizes.push(static_cast<uint32_t>(n));
+    }
+
+    size_t size() const { return doc_lengths.size(); }
+
+    bool write(const char* path) {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        ForwardHeader header;
+        memcpy(header.magic, FORWARD_MAGIC, sizeof(header.magic));
+        header.version = FORWARD_VERSION;
+        header.doc_count = static_cast<uint32_t>(doc_lengths.size());
+        header.reserved = 0;
+        header.rows_size = rows_size;
+
+        size_t n = doc_lengths.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&row_offsets.get(0), sizeof(uint64_t), n + 1, file) == n + 1;
+        if (n > 0) {
+            ok = ok && fwrite(&doc_lengths.get(0), sizeof(uint32_t), n, file) == n;
+            ok = ok && fwrite(&row_sizes.get(0), sizeof(uint32_t), n, file) == n;
+        }
+        if (rows_size > 0) {
+            ok = ok && fwrite(rows, 1, rows_size, file) == rows_size;
+        }
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+class ForwardIndex {
+private:
+    MappedFile file;
+    size_t count;
+    const uint64_t* row_offsets;
+    const uint32_t* doc_lengths;
+    const uint32_t* row_sizes;
+    const unsigned char* rows;
+
+public:
+    class Row {
+    private:
+        const unsigned char* p;
+        const unsigned char* end;
+        uint32_t term_;
+        uint32_t tf_;
+
+    public:
+        Row(const unsigned char* begin, const unsigned char* finish)
+            : p(begin), end(finish), term_(0), tf_(0) {}
+
+        bool next() {
+            if (p >= end) return false;
+            term_ += static_cast<uint32_t>(read_varint(p));
+            tf_ = static_cast<uint32_t>(read_varint(p));
+            return true;
+        }
+
+        uint32_t term() const { return term_; }
+        uint32_t tf() const { return tf_; }
+    };
+
+    ForwardIndex() : count(0), row_offsets(nullptr), doc_lengths(nullptr), row_sizes(nullptr),
+                     rows(nullptr) {}
+
+    bool open(const char* path) {
+        count = 0;
+        if (!file.open(path)) return false;
+        if (file.size() < sizeof(ForwardHeader)) return false;
+
+        const ForwardHeader* header = reinterpret_cast<const ForwardHeader*>(file.data());
+        if (memcmp(header->magic, FORWARD_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != FORWARD_VERSION) {
+            return false;
+        }
+
+        size_t n = header->doc_count;
+        size_t expected = sizeof(ForwardHeader) + (n + 1) * sizeof(uint64_t) +
+                          2 * n * sizeof(uint32_t) + header->rows_size;
+        if (file.size() != expected) return false;
+
+        const char* p = file.data() + sizeof(ForwardHeader);
+        row_offsets = reinterpret_cast<const uint64_t*>(p);
+        p += (n + 1) * sizeof(uint64_t);
+        doc_lengths = reinterpret_cast<const uint32_t*>(p);
+        p += n * sizeof(uint32_t);
+        row_sizes = reinterpret_cast<const uint32_t*>(p);
+        p += n * sizeof(uint32_t);
+        rows = reinterpret_cast<const unsigned char*>(p);
+        count = n;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    uint32_t doc_length(size_t doc) const { return doc_lengths[doc]; }
+    uint32_t unique_terms(size_t doc) const { return row_sizes[doc]; }
+
+    Row row(size_t doc) const {
+        return Row(rows + row_offsets[doc], rows + row_offsets[doc + 1]);
+    }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef LEVENSHTEIN_H
+#define LEVENSHTEIN_H
+
+#include <cstring>
+#include <cstdint>
+#include "simple_vector.h"
+#include "lexicon.h"
+#include "utf8.h"
+
+// Нечёткий поиск по словарю. Автомат Левенштейна для слова w и порога k
+// задан строкой динамики: состояние после прочитанного префикса p - это
+// расстояния от p до всех префиксов w, урезанные до k + 1. Префикс жив,
+// пока в строке есть значение не больше k; термин подходит, если
+// последнее значение не больше k. Символы - коды UTF-8, так что
+// кириллическая буква - одна правка, а не две.
+
+static const int MAX_FUZZY_DISTANCE = 2;
+
+class LevenshteinAutomaton {
+private:
+    SimpleVector<uint32_t> word;
+    int max_dist;
+
+public:
+    LevenshteinAutomaton(const char* text, int k) : max_dist(k) {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(text);
+        const unsigned char* end = p + strlen(text);
+        while (p < end) word.push(utf8_next(p, end));
+    }
+
+    size_t width() const { return word.size() + 1; }
+
+    void start(int* row) const {
+        for (size_t i = 0; i < width(); i++) {
+            row[i] = static_cast<int>(i) < max_dist + 1 ? static_cast<int>(i) : max_dist + 1;
+        }
+    }
+
+    // Переход по символу c: out - строка для префикса, длиннее на c.
+    void step(const int* row, uint32_t c, int* out) const {
+        int limit = max_dist + 1;
+        out[0] = row[0] + 1 < limit ? row[0] + 1 : limit;
+        for (size_t i = 1; i < width(); i++) {
+            int v = row[i - 1] + (word.get(i - 1) == c ? 0 : 1);
+            if (row[i] + 1 < v) v = row[i] + 1;
+            if (out[i - 1] + 1 < v) v = out[i - 1] + 1;
+            out[i] = v < limit ? v : limit;
+        }
+    }
+
+    bool can_match(const int* row) const {
+        for (size_t i = 0; i < width(); i++) {
+            if (row[i] <= max_dist) return true;
+        }
+        return false;
+    }
+
+    // Расстояние до слова; max_dist + 1 - слишком далеко.
+    int distance(const int* row) const { return row[width() - 1]; }
+    bool matches(const int* row) const { return distance(row) <= max_dist; }
+};
+
+// Пересечение автомата с отсортированным словарём. Соседние термины
+// делят префикс, и строки для общей части не пересчитываются. Если
+// префикс мёртв, все термины с ним пропускаются одним переходом курсора
+// за prefix_range, так что просматривается лишь малая часть словаря.
+inline void fuzzy_expand(const Lexicon& lexicon, const LevenshteinAutomaton& automaton,
+                         SimpleVector<size_t>& ids, SimpleVector<int>& distances) {
+    ids.clear();
+    distances.clear();
+    size_t width = automaton.width();
+    SimpleVector<int> rows;
+    SimpleVector<size_t> bytes_at;
+    rows.resize(width);
+    automaton.start(&rows.get(0));
+    bytes_at.push(0);
+
+    char path[LEXICON_MAX_TERM];
+    size_t path_len = 0;
+    Lexicon::Cursor cursor(lexicon, 0);
+    while (cursor.valid()) {
+        const char* term = cursor.term();
+        size_t len = cursor.length();
+        size_t shared = 0;
+        while (shared < len && shared < path_len && term[shared] == path[shared]) shared++;
+        size_t depth = bytes_at.size() - 1;
+        while (depth > 0 && bytes_at.get(depth) > shared) depth--;
+        bytes_at.resize(depth + 1);
+        rows.resize((depth + 1) * width);
+
+        const unsigned char* start = reinterpret_cast<const unsigned char*>(term);
+        const unsigned char* p = start + bytes_at.get(depth);
+        const unsigned char* end = start + len;
+        bool dead = false;
+        while (p < end) {
+            uint32_t c = utf8_next(p, end);
+            rows.resize((depth + 2) * width);
+            automaton.step(&rows.get(depth * width), c, &rows.get((depth + 1) * width));
+            depth++;
+            bytes_at.push(static_cast<size_t>(p - start));
+            if (!automaton.can_match(&rows.get(depth * width))) {
+                dead = true;
+                break;
+            }
+        }
+        memcpy(path, term, len);
+        path_len = len;
+
+        if (!dead) {
+            const int* row = &rows.get(depth * width);
+            if (automaton.matches(row)) {
+                ids.push(cursor.id());
+                distances.push(automaton.distance(row));
+            }
+            cursor.next();
+            continue;
+        }
+
+        // Термины с мёртвым префиксом идут подряд: в пределах блока они
+        // пропускаются шагами курсора, дальше - двоичным поиском.
+        size_t dead_len = bytes_at.get(depth);
+        size_t block_end = cursor.id() - cursor.id() % LEXICON_BLOCK_SIZE + LEXICON_BLOCK_SIZE;
+        cursor.next();
+        while (cursor.valid() && cursor.length() >= dead_len && memcmp(cursor.term(), path, dead_len) == 0) {
+            if (cursor.id() >= block_end) {
+                cursor.seek(lexicon.prefix_end(path, dead_len));
+                break;
+            }
+            cursor.next();
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,384 @@
+#ifndef LEXICON_H
+#define LEXICON_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include "simple_vector.h"
+#include "mapped_file.h"
+#include "varint.h"
+
+// Формат lexicon.bin (все секции выровнены, читается через mmap без разбора):
+//   LexiconHeader
+//   int64_t  postings_offsets[term_count]   смещение списка в index_data.bin
+//   int32_t  doc_counts[term_count]
+//   uint32_t block_offsets[block_count]     начало блока в blocks
+//   uint8_t  blocks[blocks_size]
+//
+// Термины отсортированы по strcmp и сжаты префиксным кодированием блоками
+// по block_size штук. Первый термин блока хранится целиком (varint длина +
+// байты), остальные как varint общего префикса с предыдущим, varint длины
+// суффикса и сам суффикс. block_offsets служит разреженным индексом:
+// двоичный поиск идёт по первым терминам блоков прямо в отображённом файле.
+// С версии 3 списки в index_data.bin хранятся в формате postings.h.
+
+static const char LEXICON_MAGIC[4] = {'B', 'L', 'E', 'X'};
+static const uint32_t LEXICON_VERSION = 3;
+static const uint32_t LEXICON_BLOCK_SIZE = 16;
+static const size_t LEXICON_MAX_TERM = 1024;
+
+struct LexiconHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t term_count;
+    uint32_t block_size;
+    uint64_t blocks_size;
+};
+
+class LexiconWriter {
+private:
+    SimpleVector<long long> postings_offsets;
+    SimpleVector<int> doc_counts;
+    SimpleVector<uint32_t> block_offsets;
+    unsigned char* blocks;
+    size_t blocks_size;
+    size_t blocks_capacity;
+    char prev[LEXICON_MAX_TERM];
+    size_t prev_len;
+
+    void ensure(size_t extra) {
+        if (blocks_size + extra <= blocks_capacity) return;
+        size_t new_cap = blocks_capacity ? blocks_capacity * 2 : 65536;
+        while (new_cap < blocks_size + extra) new_cap *= 2;
+        blocks = static_cast<unsigned char*>(realloc(blocks, new_cap));
+        blocks_capacity = new_cap;
+    }
+
+public:
+    LexiconWriter() : blocks(nullptr), blocks_size(0), blocks_capacity(0), prev_len(0) {}
+
+    ~LexiconWriter() {
+        free(blocks);
+    }
+
+    void reserve(size_t terms) {
+        postings_offsets.reserve(terms);
+        doc_counts.reserve(terms);
+        block_offsets.reserve(terms / LEXICON_BLOCK_SIZE + 1);
+    }
+
+    // Термины должны добавляться в порядке возрастания strcmp и быть
+    // короче LEXICON_MAX_TERM (длинные отсекает индексатор при чтении);
+    // false - термин слишком длинный и не записан.
+    bool add(const char* term, size_t len, int doc_count, long long offset) {
+        if (len >= LEXICON_MAX_TERM) return false;
+        ensure(len + 20);
+
+        if (doc_counts.size() % LEXICON_BLOCK_SIZE == 0) {
+            block_offsets.push(static_cast<uint32_t>(blocks_size));
+            blocks_size += write_varint(blocks + blocks_size, len);
+            memcpy(blocks + blocks_size, term, len);
+            blocks_size += len;
+        } else {
+            size_t shared = 0;
+            while (shared < len && shared < prev_len && term[shared] == prev[shared]) shared++;
+            blocks_size += write_varint(blocks + blocks_size, shared);
+            blocks_size += write_varint(blocks + blocks_size, len - shared);
+            memcpy(blocks + blocks_size, term + shared, len - shared);
+            blocks_size += len - shared;
+        }
+
+        memcpy(prev, term, len);
+        prev_len = len;
+        doc_counts.push(doc_count);
+        postings_offsets.push(offset);
+        return true;
+    }
+
+    bool add(const char* term, int doc_count, long long offset) {
+        return add(term, strlen(term), doc_count, offset);
+    }
+
+    size_t size() const { return doc_counts.size(); }
+
+    bool write(const char* path) {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        LexiconHeader header;
+        memcpy(header.magic, LEXICON_MAGIC, sizeof(header.magic));
+        header.version = LEXICON_VERSION;
+        header.term_count = static_cast<uint32_t>(doc_counts.size());
+        header.block_size = LEXICON_BLOCK_SIZE;
+        header.blocks_size = blocks_size;
+
+        size_t n = doc_counts.size();
+        size_t nb = block_offsets.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        if (n > 0) {
+            ok = ok && fwrite(&postings_offsets.get(0), sizeof(long long), n, file) == n;
+            ok = ok && fwrite(&doc_counts.get(0), sizeof(int), n, file) == n;
+            ok = ok && fwrite(&block_offsets.get(0), sizeof(uint32_t), nb, file) == nb;
+            ok = ok && fwrite(blocks, 1, blocks_size, file) == blocks_size;
+        }
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+inline int compare_terms(const char* a, size_t a_len, const char* b, size_t b_len) {
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+    if (c != 0) return c;
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+// Совпадает ли text длины len с шаблоном, где * - любая (в том числе
+// пустая) последовательность байтов. Звёздочка не разрывает символы
+// UTF-8: остальные байты шаблона сравниваются целиком.
+inline bool wildcard_match(const char* pattern, const char* text, size_t len) {
+    const char* star = nullptr;
+    size_t mark = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (*pattern == '*') {
+            star = pattern++;
+            mark = i;
+        } else if (*pattern && *pattern == text[i]) {
+            pattern++;
+            i++;
+        } else if (star) {
+            pattern = star + 1;
+            i = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') pattern++;
+    return *pattern == '\0';
+}
+
+class Lexicon {
+private:
+    MappedFile file;
+    size_t count;
+    size_t block_size;
+    size_t block_count;
+    const long long* postings_offsets;
+    const int* doc_counts;
+    const uint32_t* block_offsets;
+    const unsigned char* blocks;
+
+    const unsigned char* block_head(size_t block, size_t& len) const {
+        const unsigned char* p = blocks + block_offsets[block];
+        len = static_cast<size_t>(read_varint(p));
+        return p;
+    }
+
+public:
+    // Последовательное чтение терминов, начиная с произвольного номера.
+    class Cursor {
+    private:
+        const Lexicon* lex;
+        size_t id_;
+        const unsigned char* p;
+        char buf[LEXICON_MAX_TERM];
+        size_t len;
+
+        void decode() {
+            if (id_ >= lex->count) return;
+            if (id_ % lex->block_size == 0) {
+                p = lex->block_head(id_ / lex->block_size, len);
+                memcpy(buf, p, len);
+                p += len;
+            } else {
+                size_t shared = static_cast<size_t>(read_varint(p));
+                size_t suffix = static_cast<size_t>(read_varint(p));
+                memcpy(buf + shared, p, suffix);
+                p += suffix;
+                len = shared + suffix;
+            }
+            buf[len] = '\0';
+        }
+
+    public:
+        Cursor(const Lexicon& l, size_t start) : lex(&l), id_(0), p(nullptr), len(0) {
+            buf[0] = '\0';
+            seek(start);
+        }
+
+        void seek(size_t target) {
+            if (target >= lex->count) {
+                id_ = lex->count;
+                return;
+            }
+            id_ = target - target % lex->block_size;
+            decode();
+            while (id_ < target) {
+                id_++;
+                decode();
+            }
+        }
+
+        void next() {
+            id_++;
+            decode();
+        }
+
+        bool valid() const { return id_ < lex->count; }
+        size_t id() const { return id_; }
+        const char* term() const { return buf; }
+        size_t length() const { return len; }
+    };
+
+    Lexicon() : count(0), block_size(LEXICON_BLOCK_SIZE), block_count(0), postings_offsets(nullptr),
+                doc_counts(nullptr), block_offsets(nullptr), blocks(nullptr) {}
+
+    bool open(const char* path) {
+        count = 0;
+        if (!file.open(path)) return false;
+        if (file.size() < sizeof(LexiconHeader)) return false;
+
+        const LexiconHeader* header = reinterpret_cast<const LexiconHeader*>(file.data());
+        if (memcmp(header->magic, LEXICON_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != LEXICON_VERSION || header->block_size == 0) {
+            return false;
+        }
+
+        size_t n = header->term_count;
+        size_t nb = (n + header->block_size - 1) / header->block_size;
+        size_t expected = sizeof(LexiconHeader) + n * sizeof(long long) + n * sizeof(int) +
+                          nb * sizeof(uint32_t) + header->blocks_size;
+        if (file.size() != expected) return false;
+
+        const char* p = file.data() + sizeof(LexiconHeader);
+        postings_offsets = reinterpret_cast<const long long*>(p);
+        p += n * sizeof(long long);
+        doc_counts = reinterpret_cast<const int*>(p);
+        p += n * sizeof(int);
+        block_offsets = reinterpret_cast<const uint32_t*>(p);
+        p += nb * sizeof(uint32_t);
+        blocks = reinterpret_cast<const unsigned char*>(p);
+        block_size = header->block_size;
+        block_count = nb;
+        count = n;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    size_t memory_bytes() const { return file.size(); }
+
+    int doc_count(size_t id) const { return doc_counts[id]; }
+    long long offset(size_t id) const { return postings_offsets[id]; }
+
+    // Номер первого термина, не меньшего key (size(), если таких нет).
+    size_t lower_bound(const char* key, size_t key_len) const {
+        if (count == 0) return 0;
+
+        size_t lo = 0, hi = block_count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            size_t len;
+            const unsigned char* head = block_head(mid, len);
+            if (compare_terms(reinterpret_cast<const char*>(head), len, key, key_len) <= 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) return 0;
+
+        Cursor cursor(*this, (lo - 1) * block_size);
+        size_t block_end = lo * block_size;
+        while (cursor.valid() && cursor.id() < block_end) {
+            if (compare_terms(cursor.term(), cursor.length(), key, key_len) >= 0) {
+                return cursor.id();
+            }
+            cursor.next();
+        }
+        return block_end < count ? block_end : count;
+    }
+
+    bool find(const char* term, size_t& id) const {
+        size_t len = strlen(term);
+        size_t pos = lower_bound(term, len);
+        if (pos >= count) return false;
+
+        Cursor cursor(*this, pos);
+        if (cursor.length() != len || memcmp(cursor.term(), term, len) != 0) return false;
+        id = pos;
+        return true;
+    }
+
+    // Номер первого термина после всех, начинающихся с prefix длины len.
+    size_t prefix_end(const char* prefix, size_t len) const {
+        if (len >= LEXICON_MAX_TERM) len = LEXICON_MAX_TERM - 1;
+        char upper[LEXICON_MAX_TERM];
+        memcpy(upper, prefix, len);
+        while (len > 0 && static_cast<unsigned char>(upper[len - 1]) == 0xFF) len--;
+        if (len == 0) return count;
+        upper[len - 1]++;
+        return lower_bound(upper, len);
+    }
+
+    // Полуинтервал [first, last) терминов, начинающихся с prefix.
+    void prefix_range(const char* prefix, size_t& first, size_t& last) const {
+        size_t len = strlen(prefix);
+        if (len >= LEXICON_MAX_TERM) len = LEXICON_MAX_TERM - 1;
+        first = lower_bound(prefix, len);
+        last = prefix_end(prefix, len);
+    }
+
+    // Полуинтервал терминов, начинающихся с части шаблона до первой *.
+    void pattern_range(const char* pattern, size_t& first, size_t& last) const {
+        size_t literal = strcspn(pattern, "*");
+        first = last = 0;
+        if (literal >= LEXICON_MAX_TERM) return;
+        char prefix[LEXICON_MAX_TERM];
+        memcpy(prefix, pattern, literal);
+        prefix[literal] = '\0';
+        prefix_range(prefix, first, last);
+    }
+
+    // Номера терминов под шаблон со звёздочками. Просматривается только
+    // диапазон pattern_range.
+    void expand(const char* pattern, SimpleVector<size_t>& ids) const {
+        ids.clear();
+        size_t first, last;
+        pattern_range(pattern, first, last);
+        size_t literal = strcspn(pattern, "*");
+        const char* rest = pattern + literal;
+        bool any_tail = rest[0] == '*' && rest[1] == '\0';
+        for (Cursor cursor(*this, first); cursor.valid() && cursor.id() < last; cursor.next()) {
+            if (any_tail || wildcard_match(rest, cursor.term() + literal, cursor.length() - literal)) {
+                ids.push(cursor.id());
+            }
+        }
+    }
+
+    // Те из кандидатов (номера по возрастанию), что подходят под шаблон.
+    // Внутри блока курсор идёт вперёд, не разбирая блок заново.
+    void filter(const char* pattern, const SimpleVector<int>& candidates, SimpleVector<size_t>& ids) const {
+        ids.clear();
+        if (candidates.size() == 0 || count == 0) return;
+        Cursor cursor(*this, static_cast<size_t>(candidates.get(0)));
+        for (size_t i = 0; i < candidates.size(); i++) {
+            size_t id = static_cast<size_t>(candidates.get(i));
+            if (id >= count) break;
+            if (id > cursor.id() && id / block_size == cursor.id() / block_size) {
+                while (cursor.id() < id) cursor.next();
+            } else if (id != cursor.id()) {
+                cursor.seek(id);
+            }
+            if (wildcard_match(pattern, cursor.term(), cursor.length())) ids.push(id);
+        }
+    }
+
+    void term(size_t id, char* out, size_t out_size) const {
+        Cursor cursor(*this, id);
+        size_t len = cursor.length() < out_size - 1 ? cursor.length() : out_size - 1;
+        memcpy(out, cursor.term(), len);
+        out[len] = '\0';
+    }
+};
+
+#endif
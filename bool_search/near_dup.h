@@ -0,0 +1,176 @@
+#ifndef NEAR_DUP_H
+#define NEAR_DUP_H
+
+#include <cstdint>
+#include "simple_vector.h"
+
+// Поиск почти-дубликатов: MinHash по шинглам из трёх подряд идущих терминов
+// (одна перестановка на MINHASH_SIZE корзин с уплотнением пустых корзин),
+// LSH-разбиение подписи на LSH_BANDS полос и проверка кандидатов по оценке
+// коэффициента Жаккара.
+
+static const int MINHASH_SIZE = 64;
+static const int LSH_BANDS = 16;
+static const int LSH_ROWS = MINHASH_SIZE / LSH_BANDS;
+static const double NEAR_DUP_THRESHOLD = 0.85;
+static const int LSH_MAX_COMPARE = 32;
+
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class MinHashSketch {
+private:
+    static const uint32_t EMPTY = 0xFFFFFFFFu;
+    uint32_t bins[MINHASH_SIZE];
+    uint32_t prev[2];
+    int seen;
+
+    void add_shingle(uint64_t key) {
+        uint64_t h = mix64(key);
+        int bin = static_cast<int>(h >> 58);
+        uint32_t value = static_cast<uint32_t>(h);
+        if (value == EMPTY) value--;
+        if (value < bins[bin]) bins[bin] = value;
+    }
+
+public:
+    MinHashSketch() {
+        reset();
+    }
+
+    void reset() {
+        for (int i = 0; i < MINHASH_SIZE; i++) bins[i] = EMPTY;
+        prev[0] = prev[1] = 0;
+        seen = 0;
+    }
+
+    void add(uint32_t term_id) {
+        if (seen >= 2) {
+            add_shingle((static_cast<uint64_t>(prev[0]) << 42) ^ (static_cast<uint64_t>(prev[1]) << 21) ^ term_id);
+        }
+        prev[0] = prev[1];
+        prev[1] = term_id;
+        seen++;
+    }
+
+    // Пустые корзины берут значение ближайшей непустой справа (по кругу).
+    bool finish(uint32_t* out) {
+        if (seen > 0 && seen < 3) {
+            add_shingle((static_cast<uint64_t>(prev[0]) << 42) ^ (static_cast<uint64_t>(prev[1]) << 21) ^ 0x1FFFFF);
+        }
+        bool any = false;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            if (bins[i] != EMPTY) any = true;
+        }
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            if (!any) {
+                out[i] = EMPTY;
+                continue;
+            }
+            int j = i;
+            int step = 0;
+            while (bins[j] == EMPTY) {
+                j = (j + 1) % MINHASH_SIZE;
+                step++;
+            }
+            out[i] = step == 0 ? bins[j] : static_cast<uint32_t>(mix64(bins[j] + step * 0x9E3779B9ULL));
+        }
+        return any;
+    }
+};
+
+class NearDuplicateFinder {
+private:
+    struct BandKey {
+        uint64_t hash;
+        int doc;
+
+        BandKey() : hash(0), doc(0) {}
+        BandKey(uint64_t h, int d) : hash(h), doc(d) {}
+
+        bool operator<(const BandKey& other) const {
+            if (hash != other.hash) return hash < other.hash;
+            return doc < other.doc;
+        }
+    };
+
+    SimpleVector<int> parent;
+
+    int root(int x) {
+        while (parent.get(x) != x) {
+            parent.get(x) = parent.get(parent.get(x));
+            x = parent.get(x);
+        }
+        return x;
+    }
+
+public:
+    static double similarity(const uint32_t* a, const uint32_t* b) {
+        int same = 0;
+        for (int i = 0; i < MINHASH_SIZE; i++) {
+            if (a[i] == b[i]) same++;
+        }
+        return static_cast<double>(same) / MINHASH_SIZE;
+    }
+
+    // signatures - по MINHASH_SIZE значений на документ, valid - есть ли у
+    // документа подпись. canonical[d] - наименьший номер в группе дубликатов.
+    void find(const SimpleVector<uint32_t>& signatures, const SimpleVector<char>& valid, int doc_count,
+              SimpleVector<int>& canonical, SimpleVector<float>& best_similarity) {
+        parent.clear();
+        best_similarity.clear();
+        for (int d = 0; d < doc_count; d++) {
+            parent.push(d);
+            best_similarity.push(0.0f);
+        }
+
+        SimpleVector<BandKey> keys;
+        for (int band = 0; band < LSH_BANDS; band++) {
+            keys.clear();
+            for (int d = 0; d < doc_count; d++) {
+                if (!valid.get(d)) continue;
+                const uint32_t* sig = &signatures.get(static_cast<size_t>(d) * MINHASH_SIZE);
+                uint64_t h = static_cast<uint64_t>(band) << 56;
+                for (int r = 0; r < LSH_ROWS; r++) {
+                    h = mix64(h ^ sig[band * LSH_ROWS + r]);
+                }
+                keys.push(BandKey(h, d));
+            }
+            keys.sort_quick();
+
+            size_t run_start = 0;
+            for (size_t i = 1; i <= keys.size(); i++) {
+                if (i < keys.size() && keys.get(i).hash == keys.get(run_start).hash) continue;
+                for (size_t k = run_start + 1; k < i; k++) {
+                    int doc = keys.get(k).doc;
+                    const uint32_t* sig = &signatures.get(static_cast<size_t>(doc) * MINHASH_SIZE);
+                    size_t from = k - run_start > LSH_MAX_COMPARE ? k - LSH_MAX_COMPARE : run_start;
+                    for (size_t j = from; j < k; j++) {
+                        int other = keys.get(j).doc;
+                        double sim = similarity(sig, &signatures.get(static_cast<size_t>(other) * MINHASH_SIZE));
+                        if (sim < NEAR_DUP_THRESHOLD) continue;
+                        if (sim > best_similarity.get(doc)) best_similarity.get(doc) = static_cast<float>(sim);
+                        int a = root(doc);
+                        int b = root(other);
+                        if (a != b) {
+                            if (a < b) parent.get(b) = a;
+                            else parent.get(a) = b;
+                        }
+                    }
+                }
+                run_start = i;
+            }
+        }
+
+        canonical.clear();
+        for (int d = 0; d < doc_count; d++) {
+            canonical.push(root(d));
+        }
+    }
+};
+
+#endif
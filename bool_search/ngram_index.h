@@ -0,0 +1,242 @@
+#ifndef NGRAM_INDEX_H
+#define NGRAM_INDEX_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include "simple_vector.h"
+#include "mapped_file.h"
+#include "varint.h"
+#include "utf8.h"
+#include "set_ops.h"
+
+// Формат trigrams.bin - триграммы символов терминов словаря:
+//   TrigramHeader
+//   uint64_t offsets[gram_count + 1]     начало списка терминов в data
+//   uint32_t grams[gram_count]           ключи триграмм по возрастанию
+//   uint32_t counts[gram_count]          длины списков
+//   uint8_t  data[]                      номера терминов в lexicon.bin,
+//                                        разности в varint
+// Символы берутся из UTF-8, термин дополняется метками начала и конца,
+// так что "град" даёт ^гр, гра, рад, ад$. Ключ - хэш трёх кодов символов:
+// совпадение ключей только расширяет список кандидатов, а кандидаты всё
+// равно проверяются по самому термину.
+
+static const char TRIGRAM_MAGIC[4] = {'B', 'T', 'R', 'G'};
+static const uint32_t TRIGRAM_VERSION = 1;
+static const uint32_t GRAM_BEGIN = 1;
+static const uint32_t GRAM_END = 2;
+
+struct TrigramHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t gram_count;
+    uint32_t term_count;
+};
+
+inline uint32_t trigram_key(uint32_t a, uint32_t b, uint32_t c) {
+    uint32_t h = 2166136261u;
+    h = (h ^ a) * 16777619u;
+    h = (h ^ b) * 16777619u;
+    h = (h ^ c) * 16777619u;
+    return h;
+}
+
+// Ключи триграмм строки text (с метками начала/конца, если begin/end).
+inline void collect_trigrams(const char* text, size_t len, bool begin, bool end, SimpleVector<uint32_t>& out) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(text);
+    const unsigned char* stop = p + len;
+    uint32_t window[2];
+    int filled = 0;
+    if (begin) window[filled++] = GRAM_BEGIN;
+    while (p < stop || end) {
+        uint32_t c;
+        if (p < stop) {
+            c = utf8_next(p, stop);
+        } else {
+            c = GRAM_END;
+            end = false;
+        }
+        if (filled == 2) {
+            out.push(trigram_key(window[0], window[1], c));
+            window[0] = window[1];
+            window[1] = c;
+        } else {
+            window[filled++] = c;
+        }
+    }
+}
+
+class TrigramFileWriter {
+private:
+    SimpleVector<uint64_t> pairs;
+    SimpleVector<uint32_t> grams;
+    uint32_t term_count;
+
+public:
+    TrigramFileWriter() : term_count(0) {}
+
+    // Термины добавляются по возрастанию term_id.
+    void add(uint32_t term_id, const char* term, size_t len) {
+        grams.clear();
+        collect_trigrams(term, len, true, true, grams);
+        grams.sort_quick();
+        for (size_t i = 0; i < grams.size(); i++) {
+            if (i > 0 && grams.get(i) == grams.get(i - 1)) continue;
+            pairs.push(static_cast<uint64_t>(grams.get(i)) << 32 | term_id);
+        }
+        term_count = term_id + 1;
+    }
+
+    bool write(const char* path) {
+        pairs.sort_quick();
+        SimpleVector<uint64_t> offsets;
+        SimpleVector<uint32_t> keys;
+        SimpleVector<uint32_t> counts;
+        SimpleVector<unsigned char> data;
+        unsigned char buf[10];
+        uint32_t prev = 0;
+        offsets.push(0);
+        for (size_t i = 0; i < pairs.size(); i++) {
+            uint32_t key = static_cast<uint32_t>(pairs.get(i) >> 32);
+            uint32_t id = static_cast<uint32_t>(pairs.get(i));
+            if (keys.size() == 0 || keys.get(keys.size() - 1) != key) {
+                if (keys.size() > 0) offsets.push(data.size());
+                keys.push(key);
+                counts.push(0);
+                prev = 0;
+            }
+            size_t n = write_varint(buf, id - prev);
+            for (size_t j = 0; j < n; j++) data.push(buf[j]);
+            counts.get(counts.size() - 1)++;
+            prev = id;
+        }
+        if (keys.size() > 0) offsets.push(data.size());
+
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+        TrigramHeader header;
+        memcpy(header.magic, TRIGRAM_MAGIC, sizeof(header.magic));
+        header.version = TRIGRAM_VERSION;
+        header.gram_count = static_cast<uint32_t>(keys.size());
+        header.term_count = term_count;
+
+        size_t n = keys.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&offsets.get(0), sizeof(uint64_t), n + 1, file) == n + 1;
+        if (n > 0) {
+            ok = ok && fwrite(&keys.get(0), sizeof(uint32_t), n, file) == n;
+            ok = ok && fwrite(&counts.get(0), sizeof(uint32_t), n, file) == n;
+            ok = ok && fwrite(&data.get(0), 1, data.size(), file) == data.size();
+        }
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+class TrigramFile {
+private:
+    MappedFile file;
+    const TrigramHeader* header;
+    const uint64_t* offsets;
+    const uint32_t* grams;
+    const uint32_t* counts;
+    const unsigned char* data;
+    size_t data_size;
+
+    bool find(uint32_t key, size_t& slot) const {
+        size_t lo = 0, hi = header->gram_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (grams[mid] < key) lo = mid + 1;
+            else hi = mid;
+        }
+        slot = lo;
+        return lo < header->gram_count && grams[lo] == key;
+    }
+
+    void decode(size_t slot, SimpleVector<int>& out) const {
+        out.resize(counts[slot]);
+        const unsigned char* p = data + offsets[slot];
+        int id = 0;
+        for (size_t i = 0; i < counts[slot]; i++) {
+            id += static_cast<int>(read_varint(p));
+            out.get(i) = id;
+        }
+    }
+
+public:
+    TrigramFile() : header(nullptr), offsets(nullptr), grams(nullptr), counts(nullptr), data(nullptr), data_size(0) {}
+
+    // term_count - размер словаря сегмента: файл от другого словаря не берётся.
+    bool open(const char* path, uint32_t term_count) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(TrigramHeader)) return false;
+        const TrigramHeader* h = reinterpret_cast<const TrigramHeader*>(file.data());
+        if (memcmp(h->magic, TRIGRAM_MAGIC, sizeof(h->magic)) != 0 || h->version != TRIGRAM_VERSION ||
+            h->term_count != term_count) {
+            return false;
+        }
+        size_t n = h->gram_count;
+        size_t head = sizeof(TrigramHeader) + (n + 1) * sizeof(uint64_t) + 2 * n * sizeof(uint32_t);
+        if (file.size() < head) return false;
+        const char* p = file.data() + sizeof(TrigramHeader);
+        offsets = reinterpret_cast<const uint64_t*>(p);
+        p += (n + 1) * sizeof(uint64_t);
+        grams = reinterpret_cast<const uint32_t*>(p);
+        p += n * sizeof(uint32_t);
+        counts = reinterpret_cast<const uint32_t*>(p);
+        data = reinterpret_cast<const unsigned char*>(file.data() + head);
+        data_size = file.size() - head;
+        if (offsets[n] > data_size) return false;
+        header = h;
+        return true;
+    }
+
+    bool is_open() const { return header != nullptr; }
+
+    // Кандидаты под шаблон со звёздочками: термины, в которых есть все
+    // триграммы буквальных частей шаблона (по возрастанию номеров).
+    // false, если триграмм нет или самый короткий список не меньше
+    // limit - тогда просмотр словаря дешевле.
+    bool candidates(const char* pattern, size_t limit, SimpleVector<int>& out) const {
+        out.clear();
+        if (!header) return false;
+        SimpleVector<uint32_t> keys;
+        const char* part = pattern;
+        while (true) {
+            const char* star = strchr(part, '*');
+            size_t len = star ? static_cast<size_t>(star - part) : strlen(part);
+            collect_trigrams(part, len, part == pattern, !star, keys);
+            if (!star) break;
+            part = star + 1;
+        }
+        if (keys.size() == 0) return false;
+
+        SimpleVector<size_t> slots;
+        size_t shortest = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            size_t slot;
+            if (!find(keys.get(i), slot)) return true;
+            slots.push(slot);
+            if (counts[slot] < counts[slots.get(shortest)]) shortest = slots.size() - 1;
+        }
+        if (counts[slots.get(shortest)] >= limit) return false;
+
+        SimpleVector<int> list;
+        SimpleVector<int> tmp;
+        decode(slots.get(shortest), out);
+        for (size_t i = 0; i < slots.size() && out.size() > 0; i++) {
+            if (i == shortest || slots.get(i) == slots.get(shortest)) continue;
+            decode(slots.get(i), list);
+            tmp.resize(out.size());
+            size_t n = intersect_adaptive(&out.get(0), out.size(), &list.get(0), list.size(), &tmp.get(0));
+            tmp.resize(n);
+            out.swap(tmp);
+        }
+        return true;
+    }
+};
+
+#endif
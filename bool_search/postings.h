@@ -0,0 +1,155 @@
+#ifndef POSTINGS_H
+#define POSTINGS_H
+
+#include <cstdio>
+#include <cstring>
+#include "simple_vector.h"
+#include "mapped_file.h"
+#include "buffered_writer.h"
+#include "lexicon.h"
+#include "segments.h"
+#include "set_ops.h"
+
+// Формат списка термина в index_data.bin (lexicon.bin версии 3):
+//   int doc_count
+//   int doc_ids[doc_count]             по возрастанию
+//   int pos_offsets[doc_count + 1]     начало позиций документа в positions
+//   int positions[pos_offsets[doc_count]]
+// Номера документов лежат подряд, курсор читает и перескакивает их прямо
+// в отображённом файле; позиции нужны только фразовым запросам.
+
+struct PostingList {
+    const int* docs;
+    const int* pos_offsets;
+    const int* positions;
+    int count;
+
+    PostingList() : docs(nullptr), pos_offsets(nullptr), positions(nullptr), count(0) {}
+
+    // false, если список по смещению выходит за границы файла.
+    bool open(const MappedFile& file, long long offset) {
+        count = 0;
+        size_t words = file.size() / sizeof(int);
+        if (offset < 0 || offset % sizeof(int) != 0) return false;
+        size_t at = static_cast<size_t>(offset) / sizeof(int);
+        if (at + 1 > words) return false;
+
+        const int* p = reinterpret_cast<const int*>(file.data()) + at;
+        int n = p[0];
+        if (n < 0 || at + 2 + 2 * static_cast<size_t>(n) > words) return false;
+        const int* offsets = p + 1 + n;
+        if (offsets[n] < 0 || at + 2 + 2 * static_cast<size_t>(n) + offsets[n] > words) return false;
+
+        docs = p + 1;
+        pos_offsets = offsets;
+        positions = offsets + n + 1;
+        count = n;
+        return true;
+    }
+
+    const int* doc_positions(int i, int& n) const {
+        n = pos_offsets[i + 1] - pos_offsets[i];
+        return positions + pos_offsets[i];
+    }
+};
+
+// Курсор по списку без копирования: номера документов читаются из
+// отображения index_data.bin.
+class PostingCursor {
+private:
+    PostingList list;
+    int index;
+
+public:
+    PostingCursor() : index(0) {}
+    explicit PostingCursor(const PostingList& l) : list(l), index(0) {}
+
+    bool valid() const { return index < list.count; }
+    int doc() const { return list.docs[index]; }
+    int size() const { return list.count; }
+    void next() { index++; }
+
+    // Переход к первому документу >= target галопом (set_ops.h).
+    void seek(int target) {
+        index = static_cast<int>(gallop(list.docs, index, list.count, target));
+    }
+
+    const int* positions(int& n) const { return list.doc_positions(index, n); }
+};
+
+// Сборка одного списка в памяти (при слиянии и преобразовании индекса).
+class PostingListWriter {
+private:
+    SimpleVector<int> docs;
+    SimpleVector<int> offsets;
+    SimpleVector<int> positions;
+
+public:
+    PostingListWriter() {
+        offsets.push(0);
+    }
+
+    void clear() {
+        docs.clear();
+        offsets.clear();
+        positions.clear();
+        offsets.push(0);
+    }
+
+    void add(int doc_id, const int* pos, int n) {
+        docs.push(doc_id);
+        for (int k = 0; k < n; k++) {
+            positions.push(pos[k]);
+        }
+        offsets.push(static_cast<int>(positions.size()));
+    }
+
+    int size() const { return static_cast<int>(docs.size()); }
+    const int* doc_ids() const { return docs.size() ? &docs.get(0) : nullptr; }
+    const int* position_offsets() const { return &offsets.get(0); }
+
+    void write(BufferedWriter& out) const {
+        out.write_int(size());
+        if (docs.size() > 0) out.write(&docs.get(0), docs.size() * sizeof(int));
+        out.write(&offsets.get(0), offsets.size() * sizeof(int));
+        if (positions.size() > 0) out.write(&positions.get(0), positions.size() * sizeof(int));
+    }
+};
+
+// Версия lexicon.bin; 0 - файла нет.
+inline uint32_t lexicon_version(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return 0;
+    LexiconHeader header;
+    uint32_t version = 0;
+    if (fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, LEXICON_MAGIC, sizeof(header.magic)) == 0) {
+        version = header.version;
+    }
+    fclose(file);
+    return version;
+}
+
+// Сегмент прежнего формата: только vocabulary.txt или lexicon.bin версии
+// ниже LEXICON_VERSION. Его переписывает индексатор (--upgrade, а также --add
+// и --merge перед слиянием), поиск такие сегменты не открывает.
+inline bool segment_outdated(const char* index_dir, const char* segment) {
+    char path[512];
+    segment_path(path, sizeof(path), index_dir, segment, "lexicon.bin");
+    uint32_t version = lexicon_version(path);
+    if (version >= LEXICON_VERSION) return false;
+    if (version > 0) return true;
+    segment_path(path, sizeof(path), index_dir, segment, "vocabulary.txt");
+    FILE* vocab = fopen(path, "r");
+    if (!vocab) return false;
+    fclose(vocab);
+    return true;
+}
+
+inline bool open_segment_lexicon(const char* index_dir, const char* segment, Lexicon& lexicon) {
+    char path[512];
+    segment_path(path, sizeof(path), index_dir, segment, "lexicon.bin");
+    return lexicon.open(path);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <mutex>
+#include "simple_vector.h"
+#include "simple_hash.h"
+#include "varint.h"
+
+// Кэш результатов запросов и подвыражений. Ключ - нормализованная запись
+// узла плана (QueryPlanner::make_key), значение - список документов,
+// сжатый разностями в varint. Записи вытесняются в порядке давности
+// использования, пока занятая память больше бюджета. Отпечаток индекса
+// (index_stamp) сбрасывает кэш, если индекс изменился. Один кэш можно
+// делить между потоками пакетного режима: обращения идут под мьютексом.
+class QueryCache {
+private:
+    struct Entry {
+        char* key;
+        unsigned char* data;
+        size_t bytes;
+        size_t count;
+        int prev;
+        int next;
+    };
+
+    TermDict slots;
+    SimpleVector<Entry> entries;
+    SimpleVector<int> free_slots;
+    int head;
+    int tail;
+    size_t budget;
+    size_t used;
+    uint64_t stamp;
+    long long lookups;
+    long long hits;
+    std::mutex lock;
+
+    static size_t entry_cost(const Entry& e) {
+        return sizeof(Entry) + strlen(e.key) + 1 + e.bytes;
+    }
+
+    void unlink(int slot) {
+        Entry& e = entries.get(slot);
+        if (e.prev >= 0) entries.get(e.prev).next = e.next;
+        else head = e.next;
+        if (e.next >= 0) entries.get(e.next).prev = e.prev;
+        else tail = e.prev;
+        e.prev = e.next = -1;
+    }
+
+    void link_front(int slot) {
+        Entry& e = entries.get(slot);
+        e.prev = -1;
+        e.next = head;
+        if (head >= 0) entries.get(head).prev = slot;
+        head = slot;
+        if (tail < 0) tail = slot;
+    }
+
+    void drop_all() {
+        for (size_t i = 0; i < entries.size(); i++) {
+            free(entries.get(i).key);
+            free(entries.get(i).data);
+        }
+        entries.clear();
+        free_slots.clear();
+        slots.clear();
+        head = tail = -1;
+        used = 0;
+    }
+
+    void evict(int slot) {
+        Entry& e = entries.get(slot);
+        unlink(slot);
+        used -= entry_cost(e);
+        slots.remove(e.key);
+        free(e.key);
+        free(e.data);
+        e.key = nullptr;
+        e.data = nullptr;
+        free_slots.push(slot);
+    }
+
+public:
+    explicit QueryCache(size_t budget_bytes)
+        : slots(1024), head(-1), tail(-1), budget(budget_bytes), used(0), stamp(0), lookups(0), hits(0) {}
+
+    ~QueryCache() {
+        drop_all();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> guard(lock);
+        drop_all();
+    }
+
+    // Сброс, если индекс на диске уже не тот, для которого считались записи.
+    void validate(uint64_t index_stamp) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (index_stamp == stamp) return;
+        drop_all();
+        stamp = index_stamp;
+    }
+
+    bool enabled() const { return budget > 0; }
+
+    bool get(const char* key, SimpleVector<int>& out) {
+        if (!enabled()) return false;
+        std::lock_guard<std::mutex> guard(lock);
+        lookups++;
+        int slot;
+        if (!slots.find(key, slot)) return false;
+        hits++;
+        unlink(slot);
+        link_front(slot);
+
+        const Entry& e = entries.get(slot);
+        out.clear();
+        out.reserve(e.count);
+        const unsigned char* p = e.data;
+        int doc = -1;
+        for (size_t i = 0; i < e.count; i++) {
+            doc += static_cast<int>(read_varint(p)) + 1;
+            out.push(doc);
+        }
+        return true;
+    }
+
+    // docs - по возрастанию без повторов.
+    void put(const char* key, const int* docs, size_t n) {
+        if (!enabled()) return;
+        std::lock_guard<std::mutex> guard(lock);
+        int slot;
+        if (slots.find(key, slot)) {
+            unlink(slot);
+            link_front(slot);
+            return;
+        }
+
+        size_t bytes = 0;
+        int prev = -1;
+        for (size_t i = 0; i < n; i++) {
+            bytes += varint_size(static_cast<uint64_t>(docs[i] - prev - 1));
+            prev = docs[i];
+        }
+        size_t cost = sizeof(Entry) + strlen(key) + 1 + bytes;
+        if (cost > budget) return;
+        while (used + cost > budget && tail >= 0) evict(tail);
+
+        Entry e;
+        e.key = static_cast<char*>(malloc(strlen(key) + 1));
+        strcpy(e.key, key);
+        e.data = static_cast<unsigned char*>(malloc(bytes > 0 ? bytes : 1));
+        e.bytes = bytes;
+        e.count = n;
+        e.prev = e.next = -1;
+        unsigned char* out = e.data;
+        prev = -1;
+        for (size_t i = 0; i < n; i++) {
+            out += write_varint(out, static_cast<uint64_t>(docs[i] - prev - 1));
+            prev = docs[i];
+        }
+
+        if (free_slots.size() > 0) {
+            slot = free_slots.get(free_slots.size() - 1);
+            free_slots.pop();
+            entries.get(slot) = e;
+        } else {
+            slot = static_cast<int>(entries.size());
+            entries.push(e);
+        }
+        slots.add(e.key, slot);
+        link_front(slot);
+        used += cost;
+    }
+
+    size_t size() const { return slots.size(); }
+    size_t memory_used() const { return used; }
+    long long lookup_count() const { return lookups; }
+    long long hit_count() const { return hits; }
+
+    double hit_rate() const {
+        return lookups > 0 ? static_cast<double>(hits) / lookups : 0.0;
+    }
+};
+
+#endif
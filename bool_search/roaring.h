@@ -0,0 +1,586 @@
+#ifndef ROARING_H
+#define ROARING_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include "simple_vector.h"
+#include "bits.h"
+#include "mapped_file.h"
+#include "segments.h"
+
+// Множество номеров документов в духе Roaring (Chambi et al., "Better
+// bitmap performance with Roaring bitmaps", 2016). Номера делятся на куски
+// по 65536 (старшие 16 бит - ключ куска). Кусок хранится либо массивом
+// младших 16 бит, либо битовой картой - смотря что короче: 2 байта на
+// номер против бита на каждый номер куска. Последний кусок сегмента
+// короче остальных, его карта покрывает только номера меньше universe.
+
+static const int ROARING_SHIFT = 16;
+static const uint32_t ROARING_CHUNK = 1u << ROARING_SHIFT;
+
+struct RoaringContainer {
+    uint16_t key;
+    bool is_bitmap;
+    uint32_t cardinality;
+    SimpleVector<uint16_t> array;
+    SimpleVector<uint64_t> bits;
+
+    RoaringContainer() : key(0), is_bitmap(false), cardinality(0) {}
+};
+
+class RoaringBitmap {
+private:
+    SimpleVector<RoaringContainer*> containers;
+    uint32_t universe;
+
+    RoaringBitmap(const RoaringBitmap&);
+    RoaringBitmap& operator=(const RoaringBitmap&);
+
+    uint32_t chunk_words(uint32_t key) const {
+        uint32_t start = key << ROARING_SHIFT;
+        uint32_t span = universe - start;
+        if (span > ROARING_CHUNK) span = ROARING_CHUNK;
+        return (span + 63) / 64;
+    }
+
+    static bool prefer_bitmap(uint32_t cardinality, uint32_t words) {
+        return cardinality * 2 > words * 8;
+    }
+
+    void make_bitmap(RoaringContainer* c) const {
+        if (c->is_bitmap) return;
+        c->bits.clear();
+        c->bits.resize(chunk_words(c->key));
+        for (size_t i = 0; i < c->array.size(); i++) {
+            uint16_t v = c->array.get(i);
+            c->bits.get(v >> 6) |= 1ULL << (v & 63);
+        }
+        c->array.clear();
+        c->is_bitmap = true;
+    }
+
+    static void make_array(RoaringContainer* c) {
+        if (!c->is_bitmap) return;
+        c->array.clear();
+        c->array.reserve(c->cardinality);
+        for (size_t w = 0; w < c->bits.size(); w++) {
+            uint64_t word = c->bits.get(w);
+            while (word) {
+                c->array.push(static_cast<uint16_t>(w * 64 + ctz64(word)));
+                word &= word - 1;
+            }
+        }
+        c->bits.clear();
+        c->is_bitmap = false;
+    }
+
+    static uint32_t count_bits(const RoaringContainer* c) {
+        uint32_t total = 0;
+        for (size_t w = 0; w < c->bits.size(); w++) {
+            total += popcount64(c->bits.get(w));
+        }
+        return total;
+    }
+
+    // Выбор более короткого представления и добавление в конец.
+    void push(RoaringContainer* c) {
+        if (c->cardinality == 0) {
+            delete c;
+            return;
+        }
+        if (c->is_bitmap && !prefer_bitmap(c->cardinality, chunk_words(c->key))) make_array(c);
+        else if (!c->is_bitmap && prefer_bitmap(c->cardinality, chunk_words(c->key))) make_bitmap(c);
+        containers.push(c);
+    }
+
+    static RoaringContainer* clone(const RoaringContainer* c) {
+        RoaringContainer* copy = new RoaringContainer();
+        copy->key = c->key;
+        copy->is_bitmap = c->is_bitmap;
+        copy->cardinality = c->cardinality;
+        copy->array = c->array;
+        copy->bits = c->bits;
+        return copy;
+    }
+
+    static bool has_bit(const RoaringContainer* c, uint16_t v) {
+        return (c->bits.get(v >> 6) >> (v & 63)) & 1;
+    }
+
+    static RoaringContainer* container_and(const RoaringContainer* a, const RoaringContainer* b) {
+        RoaringContainer* out = new RoaringContainer();
+        out->key = a->key;
+        if (a->is_bitmap && b->is_bitmap) {
+            out->is_bitmap = true;
+            out->bits.resize(a->bits.size());
+            for (size_t w = 0; w < a->bits.size(); w++) {
+                out->bits.get(w) = a->bits.get(w) & b->bits.get(w);
+            }
+            out->cardinality = count_bits(out);
+        } else if (a->is_bitmap || b->is_bitmap) {
+            const RoaringContainer* arr = a->is_bitmap ? b : a;
+            const RoaringContainer* bmp = a->is_bitmap ? a : b;
+            for (size_t i = 0; i < arr->array.size(); i++) {
+                if (has_bit(bmp, arr->array.get(i))) out->array.push(arr->array.get(i));
+            }
+            out->cardinality = static_cast<uint32_t>(out->array.size());
+        } else {
+            size_t i = 0, j = 0;
+            while (i < a->array.size() && j < b->array.size()) {
+                uint16_t x = a->array.get(i), y = b->array.get(j);
+                if (x < y) i++;
+                else if (y < x) j++;
+                else {
+                    out->array.push(x);
+                    i++;
+                    j++;
+                }
+            }
+            out->cardinality = static_cast<uint32_t>(out->array.size());
+        }
+        return out;
+    }
+
+    RoaringContainer* container_or(const RoaringContainer* a, const RoaringContainer* b) const {
+        RoaringContainer* out = new RoaringContainer();
+        out->key = a->key;
+        if (!a->is_bitmap && !b->is_bitmap) {
+            size_t i = 0, j = 0;
+            while (i < a->array.size() || j < b->array.size()) {
+                if (j == b->array.size() || (i < a->array.size() && a->array.get(i) < b->array.get(j))) {
+                    out->array.push(a->array.get(i++));
+                } else if (i == a->array.size() || b->array.get(j) < a->array.get(i)) {
+                    out->array.push(b->array.get(j++));
+                } else {
+                    out->array.push(a->array.get(i));
+                    i++;
+                    j++;
+                }
+            }
+            out->cardinality = static_cast<uint32_t>(out->array.size());
+            return out;
+        }
+
+        const RoaringContainer* bmp = a->is_bitmap ? a : b;
+        const RoaringContainer* other = a->is_bitmap ? b : a;
+        out->is_bitmap = true;
+        out->bits = bmp->bits;
+        if (other->is_bitmap) {
+            for (size_t w = 0; w < out->bits.size(); w++) {
+                out->bits.get(w) |= other->bits.get(w);
+            }
+        } else {
+            for (size_t i = 0; i < other->array.size(); i++) {
+                uint16_t v = other->array.get(i);
+                out->bits.get(v >> 6) |= 1ULL << (v & 63);
+            }
+        }
+        out->cardinality = count_bits(out);
+        return out;
+    }
+
+    static RoaringContainer* container_andnot(const RoaringContainer* a, const RoaringContainer* b) {
+        RoaringContainer* out = new RoaringContainer();
+        out->key = a->key;
+        if (a->is_bitmap) {
+            out->is_bitmap = true;
+            out->bits = a->bits;
+            if (b->is_bitmap) {
+                for (size_t w = 0; w < out->bits.size(); w++) {
+                    out->bits.get(w) &= ~b->bits.get(w);
+                }
+            } else {
+                for (size_t i = 0; i < b->array.size(); i++) {
+                    uint16_t v = b->array.get(i);
+                    out->bits.get(v >> 6) &= ~(1ULL << (v & 63));
+                }
+            }
+            out->cardinality = count_bits(out);
+        } else if (b->is_bitmap) {
+            for (size_t i = 0; i < a->array.size(); i++) {
+                if (!has_bit(b, a->array.get(i))) out->array.push(a->array.get(i));
+            }
+            out->cardinality = static_cast<uint32_t>(out->array.size());
+        } else {
+            size_t j = 0;
+            for (size_t i = 0; i < a->array.size(); i++) {
+                uint16_t x = a->array.get(i);
+                while (j < b->array.size() && b->array.get(j) < x) j++;
+                if (j == b->array.size() || b->array.get(j) != x) out->array.push(x);
+            }
+            out->cardinality = static_cast<uint32_t>(out->array.size());
+        }
+        return out;
+    }
+
+public:
+    explicit RoaringBitmap(uint32_t doc_count = 0) : universe(doc_count) {}
+
+    ~RoaringBitmap() {
+        clear();
+    }
+
+    void clear() {
+        for (size_t i = 0; i < containers.size(); i++) delete containers.get(i);
+        containers.clear();
+    }
+
+    void reset(uint32_t doc_count) {
+        clear();
+        universe = doc_count;
+    }
+
+    void swap(RoaringBitmap& other) {
+        containers.swap(other.containers);
+        uint32_t u = universe;
+        universe = other.universe;
+        other.universe = u;
+    }
+
+    long long cardinality() const {
+        long long total = 0;
+        for (size_t i = 0; i < containers.size(); i++) total += containers.get(i)->cardinality;
+        return total;
+    }
+
+    bool has_bitmap() const {
+        for (size_t i = 0; i < containers.size(); i++) {
+            if (containers.get(i)->is_bitmap) return true;
+        }
+        return false;
+    }
+
+    // docs - по возрастанию, все меньше universe.
+    void add_sorted(const int* docs, size_t n) {
+        reset(universe);
+        size_t i = 0;
+        while (i < n) {
+            uint32_t key = static_cast<uint32_t>(docs[i]) >> ROARING_SHIFT;
+            RoaringContainer* c = new RoaringContainer();
+            c->key = static_cast<uint16_t>(key);
+            while (i < n && (static_cast<uint32_t>(docs[i]) >> ROARING_SHIFT) == key) {
+                c->array.push(static_cast<uint16_t>(docs[i] & (ROARING_CHUNK - 1)));
+                i++;
+            }
+            c->cardinality = static_cast<uint32_t>(c->array.size());
+            push(c);
+        }
+    }
+
+    // Номера из [from, to) в out по возрастанию со сдвигом base, кроме
+    // удалённых.
+    void append_to(SimpleVector<int>& out, int base, const DeletionBitmap* deleted,
+                   int from = 0, int to = INT32_MAX) const {
+        if (from <= 0 && to == INT32_MAX) out.reserve(out.size() + static_cast<size_t>(cardinality()));
+        for (size_t k = 0; k < containers.size(); k++) {
+            const RoaringContainer* c = containers.get(k);
+            int high = static_cast<int>(c->key) << ROARING_SHIFT;
+            if (high >= to) break;
+            if (high + static_cast<int>(ROARING_CHUNK) <= from) continue;
+            if (c->is_bitmap) {
+                for (size_t w = 0; w < c->bits.size(); w++) {
+                    uint64_t word = c->bits.get(w);
+                    while (word) {
+                        int doc = high + static_cast<int>(w * 64 + ctz64(word));
+                        word &= word - 1;
+                        if (doc < from || doc >= to) continue;
+                        if (!deleted || !deleted->is_deleted(doc)) out.push(base + doc);
+                    }
+                }
+            } else {
+                for (size_t i = 0; i < c->array.size(); i++) {
+                    int doc = high + c->array.get(i);
+                    if (doc < from || doc >= to) continue;
+                    if (!deleted || !deleted->is_deleted(doc)) out.push(base + doc);
+                }
+            }
+        }
+    }
+
+    static void and_(const RoaringBitmap& a, const RoaringBitmap& b, RoaringBitmap& out) {
+        out.reset(a.universe);
+        size_t i = 0, j = 0;
+        while (i < a.containers.size() && j < b.containers.size()) {
+            const RoaringContainer* ca = a.containers.get(i);
+            const RoaringContainer* cb = b.containers.get(j);
+            if (ca->key < cb->key) i++;
+            else if (cb->key < ca->key) j++;
+            else {
+                out.push(container_and(ca, cb));
+                i++;
+                j++;
+            }
+        }
+    }
+
+    static void or_(const RoaringBitmap& a, const RoaringBitmap& b, RoaringBitmap& out) {
+        out.reset(a.universe);
+        size_t i = 0, j = 0;
+        while (i < a.containers.size() || j < b.containers.size()) {
+            const RoaringContainer* ca = i < a.containers.size() ? a.containers.get(i) : nullptr;
+            const RoaringContainer* cb = j < b.containers.size() ? b.containers.get(j) : nullptr;
+            if (!cb || (ca && ca->key < cb->key)) {
+                out.push(clone(ca));
+                i++;
+            } else if (!ca || cb->key < ca->key) {
+                out.push(clone(cb));
+                j++;
+            } else {
+                out.push(out.container_or(ca, cb));
+                i++;
+                j++;
+            }
+        }
+    }
+
+    // a без элементов b.
+    static void andnot(const RoaringBitmap& a, const RoaringBitmap& b, RoaringBitmap& out) {
+        out.reset(a.universe);
+        size_t j = 0;
+        for (size_t i = 0; i < a.containers.size(); i++) {
+            const RoaringContainer* ca = a.containers.get(i);
+            while (j < b.containers.size() && b.containers.get(j)->key < ca->key) j++;
+            if (j < b.containers.size() && b.containers.get(j)->key == ca->key) {
+                out.push(container_andnot(ca, b.containers.get(j)));
+            } else {
+                out.push(clone(ca));
+            }
+        }
+    }
+
+    // [0, universe) без элементов множества.
+    void complement(RoaringBitmap& out) const {
+        out.reset(universe);
+        uint32_t chunks = (universe + ROARING_CHUNK - 1) >> ROARING_SHIFT;
+        size_t j = 0;
+        for (uint32_t key = 0; key < chunks; key++) {
+            RoaringContainer* c = new RoaringContainer();
+            c->key = static_cast<uint16_t>(key);
+            c->is_bitmap = true;
+            uint32_t words = chunk_words(key);
+            const RoaringContainer* src = nullptr;
+            if (j < containers.size() && containers.get(j)->key == key) src = containers.get(j++);
+
+            if (src && src->is_bitmap) {
+                c->bits = src->bits;
+                for (uint32_t w = 0; w < words; w++) c->bits.get(w) = ~c->bits.get(w);
+            } else {
+                c->bits.resize(words);
+                for (uint32_t w = 0; w < words; w++) c->bits.get(w) = ~0ULL;
+                if (src) {
+                    for (size_t i = 0; i < src->array.size(); i++) {
+                        uint16_t v = src->array.get(i);
+                        c->bits.get(v >> 6) &= ~(1ULL << (v & 63));
+                    }
+                }
+            }
+            uint32_t span = universe - (key << ROARING_SHIFT);
+            if (span < ROARING_CHUNK && span % 64 != 0) {
+                c->bits.get(words - 1) &= (1ULL << (span % 64)) - 1;
+            }
+            c->cardinality = count_bits(c);
+            out.push(c);
+        }
+    }
+
+    // Сериализация: uint32 число кусков, для каждого uint16 ключ,
+    // uint16 вид (1 - карта), uint32 мощность, затем карта на
+    // chunk_words(key) слов uint64 или массив мощность * uint16.
+    size_t serialized_size() const {
+        size_t size = sizeof(uint32_t);
+        for (size_t i = 0; i < containers.size(); i++) {
+            const RoaringContainer* c = containers.get(i);
+            size += 2 * sizeof(uint16_t) + sizeof(uint32_t);
+            size += c->is_bitmap ? c->bits.size() * sizeof(uint64_t) : c->array.size() * sizeof(uint16_t);
+        }
+        return size;
+    }
+
+    void serialize(unsigned char* out) const {
+        uint32_t count = static_cast<uint32_t>(containers.size());
+        memcpy(out, &count, sizeof(count));
+        out += sizeof(count);
+        for (size_t i = 0; i < containers.size(); i++) {
+            const RoaringContainer* c = containers.get(i);
+            uint16_t kind = c->is_bitmap ? 1 : 0;
+            memcpy(out, &c->key, sizeof(uint16_t));
+            memcpy(out + 2, &kind, sizeof(uint16_t));
+            memcpy(out + 4, &c->cardinality, sizeof(uint32_t));
+            out += 8;
+            size_t bytes = c->is_bitmap ? c->bits.size() * sizeof(uint64_t) : c->array.size() * sizeof(uint16_t);
+            if (bytes > 0) {
+                memcpy(out, c->is_bitmap ? static_cast<const void*>(&c->bits.get(0))
+                                         : static_cast<const void*>(&c->array.get(0)), bytes);
+            }
+            out += bytes;
+        }
+    }
+
+    bool deserialize(const unsigned char* p, const unsigned char* end) {
+        reset(universe);
+        uint32_t count;
+        if (end - p < 4) return false;
+        memcpy(&count, p, sizeof(count));
+        p += sizeof(count);
+        for (uint32_t i = 0; i < count; i++) {
+            if (end - p < 8) return false;
+            RoaringContainer* c = new RoaringContainer();
+            uint16_t kind;
+            memcpy(&c->key, p, sizeof(uint16_t));
+            memcpy(&kind, p + 2, sizeof(uint16_t));
+            memcpy(&c->cardinality, p + 4, sizeof(uint32_t));
+            p += 8;
+            c->is_bitmap = kind == 1;
+            size_t n = c->is_bitmap ? chunk_words(c->key) : c->cardinality;
+            size_t bytes = n * (c->is_bitmap ? sizeof(uint64_t) : sizeof(uint16_t));
+            if (static_cast<size_t>(end - p) < bytes) {
+                delete c;
+                return false;
+            }
+            if (c->is_bitmap) {
+                c->bits.resize(n);
+                if (n > 0) memcpy(&c->bits.get(0), p, bytes);
+            } else {
+                c->array.resize(n);
+                if (n > 0) memcpy(&c->array.get(0), p, bytes);
+            }
+            p += bytes;
+            containers.push(c);
+        }
+        return true;
+    }
+};
+
+// Формат bitmaps.bin - множества плотных терминов сегмента:
+//   RoaringHeader
+//   uint64_t offsets[term_count + 1]     начало множества в data
+//   uint32_t term_ids[term_count]        порядковые номера в lexicon.bin
+//   uint8_t  data[]                      RoaringBitmap::serialize
+// Плотный термин встречается больше чем в 1/16 документов сегмента:
+// тогда карта короче массива 16-битных номеров.
+
+static const char ROARING_MAGIC[4] = {'B', 'R', 'B', 'M'};
+static const uint32_t ROARING_VERSION = 1;
+
+struct RoaringHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t term_count;
+    uint32_t universe;
+};
+
+inline bool is_dense_term(long long doc_count, long long universe) {
+    return doc_count * 16 > universe;
+}
+
+class RoaringFileWriter {
+private:
+    SimpleVector<uint32_t> term_ids;
+    SimpleVector<uint64_t> offsets;
+    unsigned char* data;
+    size_t data_size;
+    size_t data_capacity;
+    uint32_t universe;
+
+public:
+    explicit RoaringFileWriter(uint32_t doc_count)
+        : data(nullptr), data_size(0), data_capacity(0), universe(doc_count) {
+        offsets.push(0);
+    }
+
+    ~RoaringFileWriter() {
+        free(data);
+    }
+
+    // Термины добавляются по возрастанию term_id.
+    void add(uint32_t term_id, const int* docs, size_t n) {
+        if (!is_dense_term(static_cast<long long>(n), universe)) return;
+        RoaringBitmap set(universe);
+        set.add_sorted(docs, n);
+
+        size_t size = set.serialized_size();
+        if (data_size + size > data_capacity) {
+            size_t new_cap = data_capacity ? data_capacity * 2 : 65536;
+            while (new_cap < data_size + size) new_cap *= 2;
+            data = static_cast<unsigned char*>(realloc(data, new_cap));
+            data_capacity = new_cap;
+        }
+        set.serialize(data + data_size);
+        data_size += size;
+        term_ids.push(term_id);
+        offsets.push(data_size);
+    }
+
+    bool write(const char* path) const {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        RoaringHeader header;
+        memcpy(header.magic, ROARING_MAGIC, sizeof(header.magic));
+        header.version = ROARING_VERSION;
+        header.term_count = static_cast<uint32_t>(term_ids.size());
+        header.universe = universe;
+
+        size_t n = term_ids.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&offsets.get(0), sizeof(uint64_t), n + 1, file) == n + 1;
+        if (n > 0) ok = ok && fwrite(&term_ids.get(0), sizeof(uint32_t), n, file) == n;
+        if (data_size > 0) ok = ok && fwrite(data, 1, data_size, file) == data_size;
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+class RoaringFile {
+private:
+    MappedFile file;
+    const RoaringHeader* header;
+    const uint32_t* term_ids;
+    const uint64_t* offsets;
+    const unsigned char* data;
+    size_t data_size;
+
+public:
+    RoaringFile() : header(nullptr), term_ids(nullptr), offsets(nullptr), data(nullptr), data_size(0) {}
+
+    bool open(const char* path, uint32_t universe) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(RoaringHeader)) return false;
+        const RoaringHeader* h = reinterpret_cast<const RoaringHeader*>(file.data());
+        if (memcmp(h->magic, ROARING_MAGIC, sizeof(h->magic)) != 0 || h->version != ROARING_VERSION ||
+            h->universe != universe) {
+            return false;
+        }
+        size_t n = h->term_count;
+        size_t head = sizeof(RoaringHeader) + n * sizeof(uint32_t) + (n + 1) * sizeof(uint64_t);
+        if (file.size() < head) return false;
+        offsets = reinterpret_cast<const uint64_t*>(file.data() + sizeof(RoaringHeader));
+        term_ids = reinterpret_cast<const uint32_t*>(file.data() + sizeof(RoaringHeader) + (n + 1) * sizeof(uint64_t));
+        data = reinterpret_cast<const unsigned char*>(file.data() + head);
+        data_size = file.size() - head;
+        if (offsets[n] > data_size) return false;
+        header = h;
+        return true;
+    }
+
+    bool contains(uint32_t term_id, size_t& slot) const {
+        if (!header) return false;
+        size_t lo = 0, hi = header->term_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (term_ids[mid] < term_id) lo = mid + 1;
+            else hi = mid;
+        }
+        slot = lo;
+        return lo < header->term_count && term_ids[lo] == term_id;
+    }
+
+    bool load(size_t slot, RoaringBitmap& out) const {
+        if (offsets[slot] > offsets[slot + 1] || offsets[slot + 1] > data_size) return false;
+        return out.deserialize(data + offsets[slot], data + offsets[slot + 1]);
+    }
+};
+
+#endif
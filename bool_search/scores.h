@@ -0,0 +1,154 @@
+#ifndef SCORES_H
+#define SCORES_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include "simple_vector.h"
+#include "mapped_file.h"
+
+// Формат scores.bin - данные для ранжирования BM25:
+//   ScoreHeader
+//   uint64_t block_starts[term_count + 1]   первый блок термина в blocks
+//   uint32_t doc_lengths[doc_count]         число вхождений в документе
+//   BlockBound blocks[]
+// Частота термина в документе не хранится отдельно: это число его
+// позиций в index_data.bin. Список термина делится на блоки по
+// SCORE_BLOCK документов; для блока запоминаются наибольшая частота и
+// наименьшая длина документа. Вклад BM25 растёт с частотой и падает с
+// длиной, поэтому пара даёт верхнюю границу вклада любого документа
+// блока при любых idf и средней длине (по всем сегментам сразу).
+
+static const char SCORE_MAGIC[4] = {'B', 'S', 'C', 'R'};
+static const uint32_t SCORE_VERSION = 1;
+static const uint32_t SCORE_BLOCK = 64;
+
+static const double BM25_K1 = 1.2;
+static const double BM25_B = 0.75;
+
+struct ScoreHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint32_t block_size;
+    uint32_t reserved;
+    uint64_t total_length;
+};
+
+struct BlockBound {
+    uint32_t max_tf;
+    uint32_t min_length;
+};
+
+inline double bm25_idf(long long df, long long doc_count) {
+    return log(1.0 + (doc_count - df + 0.5) / (df + 0.5));
+}
+
+// Вклад частоты tf в документе длины length (без idf).
+inline double bm25_tf(double tf, double length, double avg_length) {
+    double norm = BM25_K1 * (1.0 - BM25_B + BM25_B * length / avg_length);
+    return tf * (BM25_K1 + 1.0) / (tf + norm);
+}
+
+class ScoreFileWriter {
+private:
+    const SimpleVector<uint32_t>& lengths;
+    SimpleVector<uint64_t> block_starts;
+    SimpleVector<BlockBound> blocks;
+
+public:
+    // doc_lengths - длины всех документов сегмента, посчитанные заранее.
+    explicit ScoreFileWriter(const SimpleVector<uint32_t>& doc_lengths) : lengths(doc_lengths) {
+        block_starts.push(0);
+    }
+
+    // Термины по порядку lexicon.bin; pos_offsets - как в index_data.bin.
+    void add(const int* docs, const int* pos_offsets, size_t n) {
+        for (size_t start = 0; start < n; start += SCORE_BLOCK) {
+            size_t end = start + SCORE_BLOCK < n ? start + SCORE_BLOCK : n;
+            BlockBound bound;
+            bound.max_tf = 0;
+            bound.min_length = UINT32_MAX;
+            for (size_t i = start; i < end; i++) {
+                uint32_t tf = static_cast<uint32_t>(pos_offsets[i + 1] - pos_offsets[i]);
+                uint32_t length = lengths.get(docs[i]);
+                if (tf > bound.max_tf) bound.max_tf = tf;
+                if (length < bound.min_length) bound.min_length = length;
+            }
+            blocks.push(bound);
+        }
+        block_starts.push(blocks.size());
+    }
+
+    bool write(const char* path) const {
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        ScoreHeader header;
+        memcpy(header.magic, SCORE_MAGIC, sizeof(header.magic));
+        header.version = SCORE_VERSION;
+        header.doc_count = static_cast<uint32_t>(lengths.size());
+        header.term_count = static_cast<uint32_t>(block_starts.size() - 1);
+        header.block_size = SCORE_BLOCK;
+        header.reserved = 0;
+        header.total_length = 0;
+        for (size_t i = 0; i < lengths.size(); i++) header.total_length += lengths.get(i);
+
+        size_t nt = block_starts.size();
+        size_t nd = lengths.size();
+        size_t nb = blocks.size();
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        ok = ok && fwrite(&block_starts.get(0), sizeof(uint64_t), nt, file) == nt;
+        if (nd > 0) ok = ok && fwrite(&lengths.get(0), sizeof(uint32_t), nd, file) == nd;
+        if (nb > 0) ok = ok && fwrite(&blocks.get(0), sizeof(BlockBound), nb, file) == nb;
+        if (fclose(file) != 0) ok = false;
+        return ok;
+    }
+};
+
+class ScoreFile {
+private:
+    MappedFile file;
+    const ScoreHeader* header;
+    const uint64_t* block_starts;
+    const uint32_t* lengths;
+    const BlockBound* blocks;
+
+public:
+    ScoreFile() : header(nullptr), block_starts(nullptr), lengths(nullptr), blocks(nullptr) {}
+
+    bool open(const char* path, uint32_t doc_count, uint32_t term_count) {
+        header = nullptr;
+        if (!file.open(path) || file.size() < sizeof(ScoreHeader)) return false;
+        const ScoreHeader* h = reinterpret_cast<const ScoreHeader*>(file.data());
+        if (memcmp(h->magic, SCORE_MAGIC, sizeof(h->magic)) != 0 || h->version != SCORE_VERSION ||
+            h->doc_count != doc_count || h->term_count != term_count || h->block_size != SCORE_BLOCK) {
+            return false;
+        }
+        size_t head = sizeof(ScoreHeader) + (static_cast<size_t>(term_count) + 1) * sizeof(uint64_t) +
+                      static_cast<size_t>(doc_count) * sizeof(uint32_t);
+        if (file.size() < head) return false;
+        const char* p = file.data() + sizeof(ScoreHeader);
+        block_starts = reinterpret_cast<const uint64_t*>(p);
+        p += (static_cast<size_t>(term_count) + 1) * sizeof(uint64_t);
+        lengths = reinterpret_cast<const uint32_t*>(p);
+        blocks = reinterpret_cast<const BlockBound*>(file.data() + head);
+        if (block_starts[term_count] * sizeof(BlockBound) != file.size() - head) return false;
+        header = h;
+        return true;
+    }
+
+    bool is_open() const { return header != nullptr; }
+    uint64_t total_length() const { return header ? header->total_length : 0; }
+    uint32_t doc_length(int doc) const { return lengths[doc]; }
+
+    // Границы блоков термина term_id: blocks[0..count).
+    const BlockBound* term_blocks(size_t term_id, size_t& count) const {
+        count = static_cast<size_t>(block_starts[term_id + 1] - block_starts[term_id]);
+        return blocks + block_starts[term_id];
+    }
+};
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef SEGMENTS_H
+#define SEGMENTS_H
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/stat.h>
+#include "simple_vector.h"
+#include "bits.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Сегментированный индекс: в папке индекса лежит segments.txt
+//   generation <N>
+//   <папка_сегмента>\t<число_документов>\t<поколение_удалений>
+// Каждый сегмент - обычный неизменяемый индекс (lexicon.bin, index_data.bin,
+// documents.txt) с локальными номерами документов. Глобальный номер равен
+// локальному плюс сумме размеров предыдущих сегментов. Удалённые документы
+// отмечаются в deleted_<поколение>.bin сегмента (поколение 0 - прежнее имя
+// deleted.bin). Новые удаления пишутся в файл нового поколения и видны
+// только после записи segments.txt, так что добавление сегмента вместе с
+// заменой старых версий документов публикуется одним шагом. Сегмент "."
+// означает саму папку индекса, так индекс, построенный целиком,
+// подхватывается без перестройки.
+
+static const char* const SEGMENT_FILES[] = {
+    "lexicon.bin", "index_data.bin", "vocabulary.txt", "documents.txt", "stats.txt", "deleted.bin",
+    "zipf_data.csv", "zipf_results.json", "duplicates.txt",
+    "forward.bin", "stats.json", "bitmaps.bin", "trigrams.bin",
+    "completions.bin", "scores.bin"
+};
+
+struct SegmentInfo {
+    char name[64];
+    int doc_count;
+    int deletions;
+
+    SegmentInfo() : doc_count(0), deletions(0) {
+        name[0] = '\0';
+    }
+
+    SegmentInfo(const char* n, int count, int deletion_gen = 0) : doc_count(count), deletions(deletion_gen) {
+        strncpy(name, n, sizeof(name) - 1);
+        name[sizeof(name) - 1] = '\0';
+    }
+};
+
+inline bool replace_file(const char* from, const char* to) {
+#ifdef _WIN32
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// Файл создаётся, только если его ещё нет.
+inline bool create_exclusive(const char* path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    CloseHandle(file);
+    return true;
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+#endif
+}
+
+// Индекс меняет только один процесс индексатора: index.lock в папке
+// индекса создаётся на время изменения. Второй процесс получает отказ;
+// после аварийного завершения файл удаляется вручную.
+class IndexLock {
+private:
+    char path[512];
+    bool held;
+
+public:
+    IndexLock() : held(false) { path[0] = '\0'; }
+    ~IndexLock() { release(); }
+
+    bool acquire(const char* index_dir) {
+        snprintf(path, sizeof(path), "%s/index.lock", index_dir);
+        held = create_exclusive(path);
+        return held;
+    }
+
+    void release() {
+        if (held) remove(path);
+        held = false;
+    }
+
+    const char* file() const { return path; }
+};
+
+inline void segment_path(char* out, size_t size, const char* index_dir, const char* segment,
+                         const char* file) {
+    if (strcmp(segment, ".") == 0) {
+        snprintf(out, size, "%s/%s", index_dir, file);
+    } else {
+        snprintf(out, size, "%s/%s/%s", index_dir, segment, file);
+    }
+}
+
+// Файл удалений текущего поколения сегмента.
+inline void deletions_path(char* out, size_t size, const char* index_dir, const SegmentInfo& info) {
+    char file[64];
+    if (info.deletions > 0) {
+        snprintf(file, sizeof(file), "deleted_%06d.bin", info.deletions);
+    } else {
+        snprintf(file, sizeof(file), "deleted.bin");
+    }
+    segment_path(out, size, index_dir, info.name, file);
+}
+
+class SegmentManifest {
+public:
+    int generation;
+    SimpleVector<SegmentInfo> segments;
+
+    SegmentManifest() : generation(0) {}
+
+    bool load(const char* index_dir) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/segments.txt", index_dir);
+        FILE* file = fopen(path, "r");
+        if (!file) return false;
+
+        segments.clear();
+        generation = 0;
+        char line[512];
+        while (fgets(line, sizeof(line), file)) {
+            char name[64];
+            int count;
+            int deletions = 0;
+            if (sscanf(line, "generation %d", &count) == 1) {
+                generation = count;
+            } else if (sscanf(line, "%63[^\t]\t%d\t%d", name, &count, &deletions) >= 2) {
+                segments.push(SegmentInfo(name, count, deletions));
+            }
+        }
+        fclose(file);
+        return true;
+    }
+
+    // Запись через временный файл: читатели видят либо старый, либо новый список.
+    bool save(const char* index_dir) const {
+        char path[512];
+        char tmp_path[512];
+        snprintf(path, sizeof(path), "%s/segments.txt", index_dir);
+        snprintf(tmp_path, sizeof(tmp_path), "%s/segments.txt.tmp", index_dir);
+
+        FILE* file = fopen(tmp_path, "w");
+        if (!file) return false;
+        fprintf(file, "generation %d\n", generation);
+        for (size_t i = 0; i < segments.size(); i++) {
+            const SegmentInfo& info = segments.get(i);
+            fprintf(file, "%s\t%d\t%d\n", info.name, info.doc_count, info.deletions);
+        }
+        if (fclose(file) != 0) return false;
+        return replace_file(tmp_path, path);
+    }
+
+    int total_docs() const {
+        int total = 0;
+        for (size_t i = 0; i < segments.size(); i++) {
+            total += segments.get(i).doc_count;
+        }
+        return total;
+    }
+};
+
+class DeletionBitmap {
+private:
+    SimpleVector<uint64_t> words;
+    int deleted;
+
+public:
+    DeletionBitmap() : deleted(0) {}
+
+    void reset(int doc_count) {
+        words.clear();
+        for (int i = 0; i < (doc_count + 63) / 64; i++) {
+            words.push(0);
+        }
+        deleted = 0;
+    }
+
+    // Отсутствующий файл означает, что удалений нет.
+    bool load(const char* path, int doc_count) {
+        reset(doc_count);
+        FILE* file = fopen(path, "rb");
+        if (!file) return false;
+        if (words.size() > 0) {
+            size_t got = fread(&words.get(0), sizeof(uint64_t), words.size(), file);
+            for (size_t i = got; i < words.size(); i++) {
+                words.get(i) = 0;
+            }
+        }
+        fclose(file);
+
+        for (size_t i = 0; i < words.size(); i++) {
+            deleted += popcount64(words.get(i));
+        }
+        return true;
+    }
+
+    bool save(const char* path) const {
+        char tmp_path[512];
+        if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= static_cast<int>(sizeof(tmp_path))) return false;
+        FILE* file = fopen(tmp_path, "wb");
+        if (!file) return false;
+        bool ok = true;
+        if (words.size() > 0) {
+            ok = fwrite(&words.get(0), sizeof(uint64_t), words.size(), file) == words.size();
+        }
+        if (fclose(file) != 0) ok = false;
+        return ok && replace_file(tmp_path, path);
+    }
+
+    bool mark(int doc) {
+        uint64_t bit = 1ULL << (doc & 63);
+        uint64_t& word = words.get(doc >> 6);
+        if (word & bit) return false;
+        word |= bit;
+        deleted++;
+        return true;
+    }
+
+    bool is_deleted(int doc) const {
+        return (words.get(doc >> 6) >> (doc & 63)) & 1;
+    }
+
+    int deleted_count() const { return deleted; }
+};
+
+// Отпечаток состояния индекса на диске. Индексатор увеличивает generation
+// в segments.txt при каждом добавлении, слиянии и удалении, поэтому
+// отпечаток берётся из содержимого списка сегментов, а не из времени
+// изменения файлов: st_mtime считается секундами, а st_ino у _stat на
+// Windows всегда 0. segments.txt с поколением пишет и полная перестройка,
+// и --upgrade, так что без него остаются только индексы, построенные
+// прежним индексатором и с тех пор не менявшиеся; для них берутся начало
+// lexicon.bin и размеры остальных файлов.
+static const size_t STAMP_HEAD_BYTES = 256;
+
+inline void stamp_mix(uint64_t& h, uint64_t value) {
+    h ^= value;
+    h *= 1099511628211ULL;
+}
+
+inline void stamp_size(uint64_t& h, const char* path) {
+    struct stat st;
+    stamp_mix(h, stat(path, &st) == 0 ? static_cast<uint64_t>(st.st_size) + 1 : 0);
+}
+
+inline void stamp_head(uint64_t& h, const char* path) {
+    unsigned char head[STAMP_HEAD_BYTES];
+    size_t got = 0;
+    FILE* file = fopen(path, "rb");
+    if (file) {
+        got = fread(head, 1, sizeof(head), file);
+        fclose(file);
+    }
+    stamp_mix(h, got);
+    for (size_t i = 0; i < got; i++) stamp_mix(h, head[i]);
+}
+
+inline uint64_t index_stamp(const char* index_dir) {
+    uint64_t h = 14695981039346656037ULL;
+    char path[512];
+    SegmentManifest manifest;
+    if (!manifest.load(index_dir)) {
+        snprintf(path, sizeof(path), "%s/lexicon.bin", index_dir);
+        stamp_head(h, path);
+        stamp_size(h, path);
+        snprintf(path, sizeof(path), "%s/index_data.bin", index_dir);
+        stamp_size(h, path);
+        snprintf(path, sizeof(path), "%s/documents.txt", index_dir);
+        stamp_size(h, path);
+        return h;
+    }
+
+    stamp_mix(h, static_cast<uint64_t>(manifest.generation) + 1);
+    for (size_t i = 0; i < manifest.segments.size(); i++) {
+        const SegmentInfo& info = manifest.segments.get(i);
+        for (const char* c = info.name; *c; c++) stamp_mix(h, static_cast<unsigned char>(*c));
+        stamp_mix(h, static_cast<uint64_t>(info.doc_count));
+        stamp_mix(h, static_cast<uint64_t>(info.deletions));
+    }
+    return h;
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef SET_OPS_H
+#define SET_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "simple_vector.h"
+#include "bits.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SET_OPS_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SET_OPS_SSE2 1
+#endif
+
+// Операции над отсортированными по возрастанию списками int без повторов.
+// Функции пишут результат в out и возвращают его длину; out должен вмещать
+// min(na, nb) элементов для пересечения, na для разности и na + nb для
+// объединения. Выбор алгоритма по соотношению длин - intersect_adaptive.
+
+// Во сколько раз длинный список должен превосходить короткий, чтобы
+// галоп был выгоднее слияния (Lemire et al., "SIMD Compression and the
+// Intersection of Sorted Integers", 2016).
+static const size_t GALLOP_RATIO = 32;
+
+// Первый индекс в [from, n) с a[i] >= target: экспоненциальный поиск
+// границы, затем двоичный.
+inline size_t gallop(const int* a, size_t from, size_t n, int target) {
+    if (from >= n || a[from] >= target) return from;
+    size_t lo = from;
+    size_t step = 1;
+    size_t hi = from + 1;
+    while (hi < n && a[hi] < target) {
+        lo = hi;
+        step <<= 1;
+        hi = from + step;
+    }
+    if (hi > n) hi = n;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < target) lo = mid;
+        else hi = mid;
+    }
+    return hi;
+}
+
+inline size_t intersect_linear(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (b[j] < a[i]) {
+            j++;
+        } else {
+            out[k++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    return k;
+}
+
+// small заметно короче large.
+inline size_t intersect_galloping(const int* small, size_t ns, const int* large, size_t nl, int* out) {
+    size_t j = 0, k = 0;
+    for (size_t i = 0; i < ns && j < nl; i++) {
+        j = gallop(large, j, nl, small[i]);
+        if (j < nl && large[j] == small[i]) out[k++] = small[i];
+    }
+    return k;
+}
+
+// Блочное сравнение "все со всеми": блок a сравнивается с блоком b и его
+// циклическими сдвигами, продвигается блок с меньшим максимумом.
+inline size_t intersect_simd(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0, j = 0, k = 0;
+#if defined(SET_OPS_AVX2)
+    if (na >= 8 && nb >= 8) {
+        const __m256i rot = _mm256_set_epi32(0, 7, 6, 5, 4, 3, 2, 1);
+        size_t na8 = na & ~static_cast<size_t>(7);
+        size_t nb8 = nb & ~static_cast<size_t>(7);
+        while (i < na8 && j < nb8) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+            __m256i m = _mm256_cmpeq_epi32(va, vb);
+            for (int r = 1; r < 8; r++) {
+                vb = _mm256_permutevar8x32_epi32(vb, rot);
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi32(va, vb));
+            }
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+            while (mask) {
+                out[k++] = a[i + ctz64(mask)];
+                mask &= mask - 1;
+            }
+            int amax = a[i + 7];
+            int bmax = b[j + 7];
+            if (amax <= bmax) i += 8;
+            if (bmax <= amax) j += 8;
+        }
+    }
+#endif
+#if defined(SET_OPS_SSE2)
+    size_t na4 = na & ~static_cast<size_t>(3);
+    size_t nb4 = nb & ~static_cast<size_t>(3);
+    while (i < na4 && j < nb4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + j));
+        __m128i m0 = _mm_cmpeq_epi32(va, vb);
+        __m128i m1 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(0, 3, 2, 1)));
+        __m128i m2 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(1, 0, 3, 2)));
+        __m128i m3 = _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, _MM_SHUFFLE(2, 1, 0, 3)));
+        __m128i m = _mm_or_si128(_mm_or_si128(m0, m1), _mm_or_si128(m2, m3));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        while (mask) {
+            out[k++] = a[i + ctz64(mask)];
+            mask &= mask - 1;
+        }
+        int amax = a[i + 3];
+        int bmax = b[j + 3];
+        if (amax <= bmax) i += 4;
+        if (bmax <= amax) j += 4;
+    }
+#endif
+    return k + intersect_linear(a + i, na - i, b + j, nb - j, out + k);
+}
+
+inline size_t intersect_adaptive(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    if (na > nb) {
+        const int* t = a;
+        a = b;
+        b = t;
+        size_t n = na;
+        na = nb;
+        nb = n;
+    }
+    if (na == 0) return 0;
+    if (nb / na >= GALLOP_RATIO) return intersect_galloping(a, na, b, nb, out);
+    return intersect_simd(a, na, b, nb, out);
+}
+
+// a без элементов b.
+inline size_t difference_adaptive(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0, j = 0, k = 0;
+    bool gallop_b = na > 0 && nb / na >= GALLOP_RATIO;
+    for (; i < na; i++) {
+        if (gallop_b) {
+            j = gallop(b, j, nb, a[i]);
+        } else {
+            while (j < nb && b[j] < a[i]) j++;
+        }
+        if (j == nb) break;
+        if (b[j] != a[i]) out[k++] = a[i];
+    }
+    while (i < na) out[k++] = a[i++];
+    return k;
+}
+
+inline size_t unite_linear(const int* a, size_t na, const int* b, size_t nb, int* out) {
+    size_t i = 0, j = 0, k = 0;
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            out[k++] = a[i++];
+        } else if (b[j] < a[i]) {
+            out[k++] = b[j++];
+        } else {
+            out[k++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    while (i < na) out[k++] = a[i++];
+    while (j < nb) out[k++] = b[j++];
+    return k;
+}
+
+// Начиная с такого числа непустых списков unite_many сливает их через
+// кучу: попарное слияние переписывает накопленный результат k раз.
+static const size_t UNITE_HEAP_LISTS = 8;
+
+struct MergeHead {
+    int doc;
+    size_t list;
+};
+
+inline void merge_sift_down(MergeHead* heap, size_t n, size_t i) {
+    MergeHead item = heap[i];
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= n) break;
+        if (child + 1 < n && heap[child + 1].doc < heap[child].doc) child++;
+        if (heap[child].doc >= item.doc) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = item;
+}
+
+// k-путевое слияние через двоичную кучу текущих голов списков:
+// O(total log k) независимо от числа списков.
+inline void unite_heap(const int* const* lists, const size_t* sizes, size_t k, SimpleVector<int>& out) {
+    out.clear();
+    MergeHead* heap = static_cast<MergeHead*>(malloc((k > 0 ? k : 1) * sizeof(MergeHead)));
+    size_t* pos = static_cast<size_t*>(calloc(k > 0 ? k : 1, sizeof(size_t)));
+    size_t n = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (sizes[i] == 0) continue;
+        heap[n].doc = lists[i][0];
+        heap[n].list = i;
+        n++;
+        total += sizes[i];
+    }
+    for (size_t i = n / 2; i-- > 0;) merge_sift_down(heap, n, i);
+
+    out.reserve(total);
+    while (n > 0) {
+        MergeHead& top = heap[0];
+        if (out.size() == 0 || out.get(out.size() - 1) != top.doc) out.push(top.doc);
+        size_t l = top.list;
+        if (++pos[l] < sizes[l]) {
+            top.doc = lists[l][pos[l]];
+        } else {
+            heap[0] = heap[--n];
+        }
+        if (n > 0) merge_sift_down(heap, n, 0);
+    }
+    free(pos);
+    free(heap);
+}
+
+// Объединение k списков. Если элементов много относительно диапазона
+// номеров, списки отмечаются в битовой карте (64 номера на слово) и
+// результат читается из неё; от UNITE_HEAP_LISTS списков они сливаются
+// через кучу, иначе попарно, короткие первыми.
+inline void unite_many(const int* const* lists, const size_t* sizes, size_t k, SimpleVector<int>& out) {
+    out.clear();
+    size_t total = 0;
+    size_t nonempty = 0;
+    int lo = 0, hi = -1;
+    for (size_t i = 0; i < k; i++) {
+        if (sizes[i] == 0) continue;
+        nonempty++;
+        if (hi < lo) {
+            lo = lists[i][0];
+            hi = lists[i][sizes[i] - 1];
+        } else {
+            if (lists[i][0] < lo) lo = lists[i][0];
+            if (lists[i][sizes[i] - 1] > hi) hi = lists[i][sizes[i] - 1];
+        }
+        total += sizes[i];
+    }
+    if (total == 0) return;
+
+    size_t range = static_cast<size_t>(hi - lo) + 1;
+    if (k > 2 && total * 32 >= range) {
+        size_t words = (range + 63) / 64;
+        uint64_t* bits = static_cast<uint64_t*>(calloc(words, sizeof(uint64_t)));
+        for (size_t i = 0; i < k; i++) {
+            const int* l = lists[i];
+            for (size_t j = 0; j < sizes[i]; j++) {
+                size_t v = static_cast<size_t>(l[j] - lo);
+                bits[v >> 6] |= 1ULL << (v & 63);
+            }
+        }
+        out.reserve(total < range ? total : range);
+        for (size_t w = 0; w < words; w++) {
+            uint64_t word = bits[w];
+            while (word) {
+                out.push(lo + static_cast<int>(w * 64 + ctz64(word)));
+                word &= word - 1;
+            }
+        }
+        free(bits);
+        return;
+    }
+
+    if (nonempty >= UNITE_HEAP_LISTS) {
+        unite_heap(lists, sizes, k, out);
+        return;
+    }
+
+    // Попарное слияние в двух буферах.
+    SimpleVector<size_t> order;
+    for (size_t i = 0; i < k; i++) {
+        if (sizes[i] == 0) continue;
+        size_t j = order.size();
+        order.push(i);
+        while (j > 0 && sizes[order.get(j - 1)] > sizes[i]) {
+            order.get(j) = order.get(j - 1);
+            j--;
+        }
+        order.get(j) = i;
+    }
+
+    SimpleVector<int> other;
+    out.resize(total);
+    other.resize(total);
+    size_t len = 0;
+    bool first = true;
+    for (size_t n = 0; n < order.size(); n++) {
+        size_t i = order.get(n);
+        if (first) {
+            memcpy(&out.get(0), lists[i], sizes[i] * sizeof(int));
+            len = sizes[i];
+            first = false;
+            continue;
+        }
+        len = unite_linear(&out.get(0), len, lists[i], sizes[i], &other.get(0));
+        out.swap(other);
+    }
+    out.resize(len);
+}
+
+#endif
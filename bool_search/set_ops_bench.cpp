@@ -0,0 +1,242 @@
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include "simple_vector.h"
+#include "lexicon.h"
+#include "segments.h"
+#include "postings.h"
+#include "set_ops.h"
+
+// Замеры ядер set_ops.h на списках из настоящего индекса: пары терминов
+// разной частоты для пересечения и группы терминов для объединения.
+
+struct TermStat {
+    int doc_count;
+    size_t id;
+
+    TermStat() : doc_count(0), id(0) {}
+    TermStat(int c, size_t i) : doc_count(c), id(i) {}
+
+    bool operator<(const TermStat& other) const {
+        if (doc_count != other.doc_count) return doc_count > other.doc_count;
+        return id < other.id;
+    }
+};
+
+typedef size_t (*IntersectKernel)(const int*, size_t, const int*, size_t, int*);
+
+struct Pair {
+    PostingList a;
+    PostingList b;
+};
+
+static double now_ms() {
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int repeats_for(long long work) {
+    long long reps = 20000000LL / (work > 0 ? work : 1);
+    if (reps < 3) reps = 3;
+    if (reps > 20000) reps = 20000;
+    return static_cast<int>(reps);
+}
+
+static void bench_intersect(const char* title, const SimpleVector<Pair>& pairs) {
+    if (pairs.size() == 0) return;
+    static const char* names[] = {"linear", "galloping", "simd", "adaptive"};
+    IntersectKernel kernels[] = {intersect_linear, intersect_galloping, intersect_simd, intersect_adaptive};
+
+    long long work = 0;
+    long long sum_a = 0, sum_b = 0;
+    size_t max_out = 0;
+    for (size_t p = 0; p < pairs.size(); p++) {
+        sum_a += pairs.get(p).a.count;
+        sum_b += pairs.get(p).b.count;
+        work += pairs.get(p).a.count + pairs.get(p).b.count;
+        size_t m = pairs.get(p).a.count < pairs.get(p).b.count ? pairs.get(p).a.count : pairs.get(p).b.count;
+        if (m > max_out) max_out = m;
+    }
+    int reps = repeats_for(work);
+    SimpleVector<int> out;
+    SimpleVector<int> expected;
+    out.resize(max_out + 1);
+    expected.resize(max_out + 1);
+
+    long long n = static_cast<long long>(pairs.size());
+    printf("%s: %zu пар, в среднем %lld и %lld документов\n", title, pairs.size(), sum_a / n, sum_b / n);
+    for (int k = 0; k < 4; k++) {
+        long long checksum = 0;
+        bool correct = true;
+        double start = now_ms();
+        for (int r = 0; r < reps; r++) {
+            for (size_t p = 0; p < pairs.size(); p++) {
+                const Pair& pair = pairs.get(p);
+                // Короткий список первым: так ждёт intersect_galloping.
+                size_t n = kernels[k](pair.a.docs, pair.a.count, pair.b.docs, pair.b.count, &out.get(0));
+                checksum += n;
+                if (r == 0) {
+                    size_t m = intersect_linear(pair.a.docs, pair.a.count, pair.b.docs, pair.b.count,
+                                                &expected.get(0));
+                    if (m != n || (n > 0 && memcmp(&out.get(0), &expected.get(0), n * sizeof(int)) != 0)) {
+                        correct = false;
+                    }
+                }
+            }
+        }
+        double elapsed = now_ms() - start;
+        printf("  %-10s %10.1f нс/пара  %6.2f нс/элемент  %s (%lld)\n", names[k],
+               elapsed * 1e6 / (static_cast<double>(reps) * pairs.size()),
+               elapsed * 1e6 / (static_cast<double>(reps) * work), correct ? "ok" : "ОШИБКА", checksum);
+    }
+}
+
+static void bench_union(const char* title, const SimpleVector<PostingList>& lists) {
+    if (lists.size() < 2) return;
+    SimpleVector<const int*> heads;
+    SimpleVector<size_t> sizes;
+    long long work = 0;
+    for (size_t i = 0; i < lists.size(); i++) {
+        heads.push(lists.get(i).docs);
+        sizes.push(lists.get(i).count);
+        work += lists.get(i).count;
+    }
+    int reps = repeats_for(work);
+
+    SimpleVector<int> merged;
+    SimpleVector<int> other;
+    merged.resize(work);
+    other.resize(work);
+    size_t chain_len = 0;
+    double start = now_ms();
+    for (int r = 0; r < reps; r++) {
+        memcpy(&merged.get(0), heads.get(0), sizes.get(0) * sizeof(int));
+        chain_len = sizes.get(0);
+        for (size_t i = 1; i < lists.size(); i++) {
+            chain_len = unite_linear(&merged.get(0), chain_len, heads.get(i), sizes.get(i), &other.get(0));
+            merged.swap(other);
+        }
+    }
+    double chain_ms = now_ms() - start;
+
+    SimpleVector<int> result;
+    start = now_ms();
+    for (int r = 0; r < reps; r++) {
+        unite_many(&heads.get(0), &sizes.get(0), lists.size(), result);
+    }
+    double many_ms = now_ms() - start;
+
+    SimpleVector<int> heap_result;
+    start = now_ms();
+    for (int r = 0; r < reps; r++) {
+        unite_heap(&heads.get(0), &sizes.get(0), lists.size(), heap_result);
+    }
+    double heap_ms = now_ms() - start;
+
+    bool correct = result.size() == chain_len &&
+                   (chain_len == 0 || memcmp(&result.get(0), &merged.get(0), chain_len * sizeof(int)) == 0);
+    bool heap_correct = heap_result.size() == chain_len &&
+                        (chain_len == 0 || memcmp(&heap_result.get(0), &merged.get(0), chain_len * sizeof(int)) == 0);
+    printf("%s: %zu списков, %lld документов, в объединении %zu\n", title, lists.size(), work, chain_len);
+    printf("  %-10s %10.1f мкс  %6.2f нс/элемент\n", "pairwise", chain_ms * 1e3 / reps, chain_ms * 1e6 / (reps * work));
+    printf("  %-10s %10.1f мкс  %6.2f нс/элемент  %s\n", "unite_many", many_ms * 1e3 / reps,
+           many_ms * 1e6 / (reps * work), correct ? "ok" : "ОШИБКА");
+    printf("  %-10s %10.1f мкс  %6.2f нс/элемент  %s\n", "unite_heap", heap_ms * 1e3 / reps,
+           heap_ms * 1e6 / (reps * work), heap_correct ? "ok" : "ОШИБКА");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Использование: " << argv[0] << " <папка_с_индексом>\n";
+        std::cout << "Замеры пересечения и объединения на списках первого сегмента\n";
+        return 1;
+    }
+
+    SegmentManifest manifest;
+    if (!manifest.load(argv[1])) {
+        manifest.segments.push(SegmentInfo(".", 0));
+    }
+    const char* segment = manifest.segments.get(0).name;
+
+    Lexicon lexicon;
+    if (!open_segment_lexicon(argv[1], segment, lexicon)) {
+        std::cerr << "Не удалось загрузить словарь" << std::endl;
+        return 1;
+    }
+    char path[512];
+    segment_path(path, sizeof(path), argv[1], segment, "index_data.bin");
+    MappedFile data;
+    if (!data.open(path)) {
+        std::cerr << "Не удалось открыть " << path << std::endl;
+        return 1;
+    }
+
+    SimpleVector<TermStat> terms;
+    for (size_t i = 0; i < lexicon.size(); i++) {
+        terms.push(TermStat(lexicon.doc_count(i), i));
+    }
+    terms.sort_quick();
+    if (terms.size() < 64) {
+        std::cerr << "Слишком маленький индекс" << std::endl;
+        return 1;
+    }
+
+    // Частые - первые 16 терминов; средние в 8-40 раз реже шестнадцатого,
+    // редкие - хотя бы в 64 раза (там intersect_adaptive выбирает галоп).
+    int base = terms.get(15).doc_count;
+    SimpleVector<PostingList> frequent, medium, rare;
+    for (size_t i = 0; i < terms.size(); i++) {
+        PostingList list;
+        int c = terms.get(i).doc_count;
+        if (!list.open(data, lexicon.offset(terms.get(i).id))) continue;
+        if (i < 16) frequent.push(list);
+        else if (c * 40 >= base && c * 8 <= base && medium.size() < 32) medium.push(list);
+        else if (c * 64 <= base && c > 0 && rare.size() < 64) rare.push(list);
+    }
+
+    SimpleVector<Pair> pairs;
+    for (size_t i = 0; i < frequent.size(); i++) {
+        for (size_t j = i + 1; j < frequent.size(); j++) {
+            Pair p;
+            p.a = frequent.get(j);
+            p.b = frequent.get(i);
+            pairs.push(p);
+        }
+    }
+    bench_intersect("частый x частый", pairs);
+
+    pairs.clear();
+    for (size_t i = 0; i < medium.size(); i++) {
+        Pair p;
+        p.a = medium.get(i);
+        p.b = frequent.get(i % frequent.size());
+        pairs.push(p);
+    }
+    bench_intersect("средний x частый", pairs);
+
+    pairs.clear();
+    for (size_t i = 0; i < rare.size(); i++) {
+        Pair p;
+        p.a = rare.get(i);
+        p.b = frequent.get(i % frequent.size());
+        pairs.push(p);
+    }
+    bench_intersect("редкий x частый", pairs);
+
+    SimpleVector<PostingList> group;
+    for (size_t i = 0; i < 8 && i < frequent.size(); i++) group.push(frequent.get(i));
+    bench_union("объединение частых", group);
+    bench_union("объединение средних", medium);
+    bench_union("объединение редких", rare);
+
+#if defined(SET_OPS_AVX2)
+    printf("SIMD: AVX2 + SSE2\n");
+#elif defined(SET_OPS_SSE2)
+    printf("SIMD: SSE2\n");
+#else
+    printf("SIMD: нет, intersect_simd работает скалярно\n");
+#endif
+    return 0;
+}
@@ -9,11 +9,13 @@ private:
     struct Node {
         char* key;
         int value;
+        unsigned int full_hash;
         Node* next;
         
-        Node(const char* k, int v) : value(v), next(nullptr) {
-            key = static_cast<char*>(malloc(strlen(k) + 1));
-            strcpy(key, k);
+        Node(const char* k, size_t len, int v, unsigned int h) : value(v), full_hash(h), next(nullptr) {
+            key = static_cast<char*>(malloc(len + 1));
+            memcpy(key, k, len);
+            key[len] = '\0';
         }
         
         ~Node() {
@@ -25,12 +27,38 @@ private:
     size_t bucket_count;
     size_t size_;
     
-    unsigned int hash(const char* str) const {
+    static unsigned int hash(const char* str, size_t len) {
         unsigned int h = 5381;
-        while (*str) {
-            h = ((h << 5) + h) + *str++;
+        for (size_t i = 0; i < len; i++) {
+            h = ((h << 5) + h) + static_cast<unsigned char>(str[i]);
         }
-        return h % bucket_count;
+        return h;
+    }
+    
+    static bool same_key(const Node* node, const char* key, size_t len) {
+        const char* k = node->key;
+        for (size_t i = 0; i < len; i++) {
+            if (k[i] != key[i]) return false;
+        }
+        return k[len] == '\0';
+    }
+    
+    void rehash() {
+        size_t new_count = bucket_count * 2;
+        Node** new_buckets = static_cast<Node**>(calloc(new_count, sizeof(Node*)));
+        for (size_t i = 0; i < bucket_count; i++) {
+            Node* node = buckets[i];
+            while (node) {
+                Node* next = node->next;
+                size_t idx = node->full_hash % new_count;
+                node->next = new_buckets[idx];
+                new_buckets[idx] = node;
+                node = next;
+            }
+        }
+        free(buckets);
+        buckets = new_buckets;
+        bucket_count = new_count;
     }
     
 public:
@@ -43,30 +71,56 @@ public:
         free(buckets);
     }
     
+    // Возвращает значение ключа; отсутствующий ключ добавляется со значением value.
+    int find_or_add(const char* key, size_t len, int value, bool& added) {
+        unsigned int h = hash(key, len);
+        Node* node = buckets[h % bucket_count];
+        
+        while (node) {
+            if (node->full_hash == h && same_key(node, key, len)) {
+                added = false;
+                return node->value;
+            }
+            node = node->next;
+        }
+        
+        if (size_ >= bucket_count) rehash();
+        size_t idx = h % bucket_count;
+        Node* new_node = new Node(key, len, value, h);
+        new_node->next = buckets[idx];
+        buckets[idx] = new_node;
+        size_++;
+        added = true;
+        return value;
+    }
+    
     void add(const char* key, int value) {
-        unsigned int idx = hash(key);
-        Node* node = buckets[idx];
+        size_t len = strlen(key);
+        unsigned int h = hash(key, len);
+        Node* node = buckets[h % bucket_count];
         
         while (node) {
-            if (strcmp(node->key, key) == 0) {
+            if (node->full_hash == h && same_key(node, key, len)) {
                 node->value = value;
                 return;
             }
             node = node->next;
         }
         
-        Node* new_node = new Node(key, value);
+        if (size_ >= bucket_count) rehash();
+        size_t idx = h % bucket_count;
+        Node* new_node = new Node(key, len, value, h);
         new_node->next = buckets[idx];
         buckets[idx] = new_node;
         size_++;
     }
     
-    bool find(const char* key, int& result) const {
-        unsigned int idx = hash(key);
-        Node* node = buckets[idx];
+    bool find(const char* key, size_t len, int& result) const {
+        unsigned int h = hash(key, len);
+        Node* node = buckets[h % bucket_count];
         
         while (node) {
-            if (strcmp(node->key, key) == 0) {
+            if (node->full_hash == h && same_key(node, key, len)) {
                 result = node->value;
                 return true;
             }
@@ -75,11 +129,33 @@ public:
         return false;
     }
     
+    bool find(const char* key, int& result) const {
+        return find(key, strlen(key), result);
+    }
+    
     bool contains(const char* key) const {
         int dummy;
         return find(key, dummy);
     }
     
+    bool remove(const char* key) {
+        size_t len = strlen(key);
+        unsigned int h = hash(key, len);
+        Node** link = &buckets[h % bucket_count];
+        
+        while (*link) {
+            Node* node = *link;
+            if (node->full_hash == h && same_key(node, key, len)) {
+                *link = node->next;
+                delete node;
+                size_--;
+                return true;
+            }
+            link = &node->next;
+        }
+        return false;
+    }
+    
     void clear() {
         for (size_t i = 0; i < bucket_count; i++) {
             Node* node = buckets[i];
@@ -94,7 +170,19 @@ public:
     }
     
     size_t size() const { return size_; }
-    
+
+    // Живые блоки памяти: массив корзин, узлы и копии ключей.
+    void memory_usage(size_t& blocks, size_t& bytes) const {
+        blocks = 1;
+        bytes = bucket_count * sizeof(Node*);
+        for (size_t i = 0; i < bucket_count; i++) {
+            for (Node* node = buckets[i]; node; node = node->next) {
+                blocks += 2;
+                bytes += sizeof(Node) + strlen(node->key) + 1;
+            }
+        }
+    }
+
     class Iterator {
     private:
         TermDict* dict;
@@ -89,6 +89,27 @@ public:
         count = 0;
     }
     
+    void swap(SimpleVector& other) {
+        T* items_tmp = items;
+        items = other.items;
+        other.items = items_tmp;
+        size_t count_tmp = count;
+        count = other.count;
+        other.count = count_tmp;
+        size_t cap_tmp = capacity_;
+        capacity_ = other.capacity_;
+        other.capacity_ = cap_tmp;
+    }
+    
+    void resize(size_t new_size) {
+        reserve(new_size);
+        while (count < new_size) {
+            new (&items[count]) T();
+            count++;
+        }
+        while (count > new_size) pop();
+    }
+    
     void reserve(size_t new_cap) {
         if (new_cap <= capacity_) return;
         T* new_items = static_cast<T*>(malloc(new_cap * sizeof(T)));
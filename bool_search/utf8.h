@@ -0,0 +1,20 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <cstdint>
+
+// Код очередного символа UTF-8; неверный байт считается символом сам по себе.
+inline uint32_t utf8_next(const unsigned char*& p, const unsigned char* end) {
+    uint32_t c = *p++;
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : 0;
+    if (c < 0x80 || p + extra > end) return c;
+    uint32_t code = c & (0x3F >> extra);
+    for (int i = 0; i < extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) return c;
+        code = (code << 6) | (p[i] & 0x3F);
+    }
+    p += extra;
+    return code;
+}
+
+#endif
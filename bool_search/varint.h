@@ -0,0 +1,38 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// LEB128: по 7 бит в байте, старший бит - признак продолжения.
+inline size_t varint_size(uint64_t value) {
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+inline size_t write_varint(unsigned char* out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<unsigned char>(value);
+    return n;
+}
+
+inline uint64_t read_varint(const unsigned char*& p) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (*p & 0x80) {
+        value |= static_cast<uint64_t>(*p++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= static_cast<uint64_t>(*p++) << shift;
+    return value;
+}
+
+#endif
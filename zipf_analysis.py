@@ -5,6 +5,30 @@ import matplotlib.pyplot as plt
 import numpy as np
 from pathlib import Path
 
+def plot_zipf(ranks, frequencies, s, C, output_dir):
+    plt.figure(figsize=(12, 6))
+    
+    plt.subplot(1, 2, 1)
+    plt.loglog(ranks, frequencies, 'b.', alpha=0.5, label='Эмпирические данные')
+    plt.loglog(ranks, [C / (r ** s) for r in ranks], 'r-', 
+               label=f'Закон Ципфа: f = {C:.2f}/r^{s:.3f}')
+    plt.xlabel('log(Ранг)')
+    plt.ylabel('log(Частота)')
+    plt.title('Закон Ципфа (логарифмическая шкала)')
+    plt.legend()
+    plt.grid(True, alpha=0.3)
+    
+    plt.subplot(1, 2, 2)
+    plt.plot(ranks[:100], frequencies[:100], 'b.-')
+    plt.xlabel('Ранг (топ-100)')
+    plt.ylabel('Частота')
+    plt.title('Топ-100 самых частых токенов')
+    plt.grid(True, alpha=0.3)
+    
+    plt.tight_layout()
+    plt.savefig(f"{output_dir}/zipf_plot.png", dpi=150)
+    plt.show()
+
 def analyze_zipf(tokens_dir: str, output_dir: str = "zipf_analysis"):
     token_counter = collections.Counter()
     token_files = list(Path(tokens_dir).glob("*.tokens"))
@@ -46,28 +70,7 @@ def analyze_zipf(tokens_dir: str, output_dir: str = "zipf_analysis"):
     with open(f"{output_dir}/zipf_results.json", 'w', encoding='utf-8') as f:
         json.dump(results, f, ensure_ascii=False, indent=2)
 
-    plt.figure(figsize=(12, 6))
-    
-    plt.subplot(1, 2, 1)
-    plt.loglog(ranks, frequencies, 'b.', alpha=0.5, label='Эмпирические данные')
-    plt.loglog(ranks, [C / (r ** s) for r in ranks], 'r-', 
-               label=f'Закон Ципфа: f = {C:.2f}/r^{s:.3f}')
-    plt.xlabel('log(Ранг)')
-    plt.ylabel('log(Частота)')
-    plt.title('Закон Ципфа (логарифмическая шкала)')
-    plt.legend()
-    plt.grid(True, alpha=0.3)
-    
-    plt.subplot(1, 2, 2)
-    plt.plot(ranks[:100], frequencies[:100], 'b.-')
-    plt.xlabel('Ранг (топ-100)')
-    plt.ylabel('Частота')
-    plt.title('Топ-100 самых частых токенов')
-    plt.grid(True, alpha=0.3)
-    
-    plt.tight_layout()
-    plt.savefig(f"{output_dir}/zipf_plot.png", dpi=150)
-    plt.show()
+    plot_zipf(ranks, frequencies, s, C, output_dir)
     
     print(f"\n=== РЕЗУЛЬТАТЫ АНАЛИЗА ЦИПФА ===")
     print(f"Уникальных токенов: {len(sorted_tokens):,}")
@@ -77,5 +80,31 @@ def analyze_zipf(tokens_dir: str, output_dir: str = "zipf_analysis"):
     
     return results
 
+def analyze_from_index(index_dir: str, output_dir: str = "zipf_analysis"):
+    """Строит графики по zipf_data.csv и zipf_results.json, которые пишет
+    bool_indexer с параметром --zipf, без повторного чтения .tokens файлов."""
+    with open(f"{index_dir}/zipf_results.json", 'r', encoding='utf-8') as f:
+        results = json.load(f)
+
+    frequencies = []
+    with open(f"{index_dir}/zipf_data.csv", 'r', encoding='utf-8') as f:
+        next(f)
+        for line in f:
+            frequencies.append(int(line.rsplit(',', 4)[1]))
+    ranks = range(1, len(frequencies) + 1)
+
+    Path(output_dir).mkdir(exist_ok=True)
+    plot_zipf(ranks, frequencies, results["zipf_parameter_s"], results["zipf_constant_C"], output_dir)
+
+    print(f"\n=== РЕЗУЛЬТАТЫ АНАЛИЗА ЦИПФА (из индекса) ===")
+    print(f"Уникальных токенов: {results['total_unique_tokens']:,}")
+    print(f"Параметр s (Ципфа): {results['zipf_parameter_s']:.4f}")
+    print(f"Константа C: {results['zipf_constant_C']:.2f}")
+
+    return results
+
 if __name__ == "__main__":
-    analyze_zipf("tokens")
\ No newline at end of file
+    if Path("index/zipf_results.json").exists():
+        analyze_from_index("index")
+    else:
+        analyze_zipf("tokens")
\ No newline at end of file